@@ -0,0 +1,48 @@
+// Benchmark of a large configuration: 2.5 GiB of physical memory behind
+// a 4 GiB virtual address space, with 1024-word pages. Frame and disk
+// offsets past 2^31 bytes go through make_address, so this fails if any
+// of that arithmetic is done in int.
+//
+// Every page from a little below the top frame to a little past the end
+// of physical memory gets a value written into its first and last words,
+// which dirties the top frames and loads the pages past them into the
+// least recently used frames. The values are read back and the time
+// taken printed.
+//
+// Build with: cc -O2 -o bigVM bigVM.c simVM.c -lpthread
+//
+#include <stdio.h>
+#include <time.h>
+#include "simVM.h"
+
+#define BIG_VPAGES 1048576
+#define BIG_PPAGES 655360
+#define BIG_PAGESIZE 1024
+#define BIG_TLB 64
+#define BIG_SPAN 2500
+
+int main(void) {
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	void *vm = createVM(BIG_VPAGES, BIG_PPAGES, BIG_PAGESIZE, BIG_TLB, 1, 1);
+	if (vm == NULL) {
+		fprintf(stderr, "bigVM: createVM failed\n");
+		return 1;
+	}
+	unsigned int first = BIG_PPAGES - BIG_SPAN, last = BIG_PPAGES + BIG_SPAN;
+	for (unsigned int page = first; page < last; page++) {
+		writeInt(vm, page * BIG_PAGESIZE, (int)page);
+		writeInt(vm, page * BIG_PAGESIZE + BIG_PAGESIZE - 1, ~(int)page);
+	}
+	int bad = 0;
+	for (unsigned int page = first; page < last; page++) {
+		bad += readInt(vm, page * BIG_PAGESIZE) != (int)page;
+		bad += readInt(vm, page * BIG_PAGESIZE + BIG_PAGESIZE - 1) != ~(int)page;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	printStatistics(vm);
+	cleanupVM(vm);
+	printf("%u pages, %d wrong values, %.2f s\n", last - first, bad,
+	       (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9);
+	return bad != 0;
+}
@@ -1,6 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include "simVM.h"
 
 //
@@ -61,26 +70,309 @@
 // first N pages loaded into physical pages (i.e. starting at physical
 // page 0), where N is the number of TLB entries.
 //
+// A system made by createDemandVM instead starts with physical memory
+// and the TLB empty, and every page is loaded by its first fault.
+//
 // The goal of the simulation is to report the number of page misses,
 // the number of TLB misses, and the number of disk writes.
 //
 
-#define VM_ROUNDROBIN_REPLACEMENT 0
-#define VM_LRU_REPLACEMENT 1
+#define VM_TLB_SEED 0x2545f4914f6cdd1dULL
+
+#define VM_TIER_MIGRATE_BATCH 16
+
+#define VM_HOST_PAGE 4096
+#define VM_HOST_HUGE_PAGE (2 << 20)
+#define VM_CACHE_LINE 64
+
+#define VM_COMPACT_LIMIT 8192
+#define VM_COMPACT_NONE 0xffff
+
+#define VM_HEAP_CLASSES 32
+
+#define VM_READAHEAD_SEQUENTIAL 8
+
+#define VM_PIN_FRAME 1
+#define VM_PIN_TLB 2
+
+// Page lists used by the 2Q and LIRS replacement algorithms. The nodes
+// live in a fixed pool and are linked by index; each node can be on two
+// lists at once, one through link[0] and one through link[1]. The head of
+// a list is its most recent end and the tail its oldest end.
+struct qlist {
+  int head, tail, len;
+};
+
+struct qnode {
+  int page, frame, state, ins;
+  int link[2][2];
+};
 
+// Pages are known to the simulation by a page number. Virtual page v of
+// the 32-bit address space is page v. Pages above it, which can only be
+// reached through the 64-bit entry points, are given the page numbers
+// from vpage upwards when they are first touched, through a hashed page
+// table (hkey/hval). npage page numbers are in use and arrays indexed by
+// page number have room for pcap.
+//
+// Once forkAddressSpace has been called there are nspace address spaces,
+// and virtual page v of address space s is page amap[s * vpage + v]
+// instead, or -1 until it is first touched; pshare counts the address
+// spaces that map each page. Pages above the 32-bit address space are
+// hashed by address space and page.
+// The entries of amap that map a page form the reverse map of the page,
+// a list through rnext and rprev starting at rhead, and rss counts the
+// resident pages of each address space. saccesses, sfaults and smisses
+// count the accesses of each address space replayed by mixTraces and the
+// page faults and TLB misses they caused.
+//
+// Physical memory and the metadata arrays are carved out of one mapping,
+// the arena. Arrays that are resized later are replaced by ordinary
+// allocations, so an array is only freed if it lies outside the arena.
+//
+// A small system is compact: pvirt, ptlb, vtlb and freeframes hold
+// 16-bit page and frame numbers, ptime and tlbtime 16-bit times relative
+// to tbase, and dirty is a bitset. They are accessed through the
+// functions below, and the system is widened to int arrays when it
+// outgrows 16 bits.
 struct VM {
   int pagesize, vpage;
   int ppage, palg, *pvirt, *ptime, *dirty;
   int tlb, tlbalg, *ptlb, *vtlb, *tlbtime; 
   int rrp, rrt, timestamp;
   int pc, tc, dc;
-  void *mem, *disk;
+  void *mem;
+  struct dpage **disk;
+  int ntier, tierplace, epoch, *tierbase, *tierlat, *heat;
+  long *tierhits, *tierprom, *tierdem, latency;
+  int tau, wshand;
+  long wssum, wsmax, wsn;
+  struct qnode *nodes;
+  int *vnode, nfree, nlir, llir;
+  struct qlist lists[3];
+  unsigned char *sketch;
+  int sketchbits, admitpage, admittlb, bypass, bypasspage;
+  long sketchn, rejpage, rejtlb;
+  int tlbways, tlbsets, *tlbset;
+  uint64_t *tlbbits;
+  uint64_t tlbrng;
+  int npage, pcap, hsize, hcount, *hval;
+  uint64_t *hkey;
+  int *dused, ndused, dcap;
+  char *arena;
+  size_t arenasize;
+  int hostpages;
+  int compact, tbase;
+  int *heapclass, *heapfree[VM_HEAP_CLASSES], heapn[VM_HEAP_CLASSES], heapcap[VM_HEAP_CLASSES];
+  int *heapruns, nruns, runcap, heaptop;
+  long heapobjs, heapwords;
+  unsigned char *advice;
+  int readahead, nfreeframes, *freeframes, demand;
+  long coldfaults, released;
+  int wmlow, wmhigh;
+  long direct, background, batches, wbruns, rfaults;
+  int rfree;
+  long prefetched, dropped, early;
+  unsigned char *pinned;
+  int *pinnext, npinned;
+  int nspace, curspace, *amap, *pshare;
+  long cowshared, cowcopies, cowfaults;
+  int *rhead, *rnext, *rprev, *rss;
+  int nseg, *segbase, *seglen;
+  long *saccesses, *sfaults, *smisses, switches;
+  int scope, *fowner, *fnext, *fprev, *ohead, *otail, *ocount, *olimit;
+  int faulttime, pffwindow, pfflow, pffhigh;
+  long elapsed, idle, suspensions, resumptions, swapped;
+};
+
+// A page of the disk image. Disk pages are allocated when a page is
+// first written back, so a NULL entry in the disk table is a page that
+// still holds its initial (zero) contents; dused lists the page numbers
+// whose entry is not NULL. Pages may be shared between handles by
+// cloneVM; a shared page is copied before it is written.
+struct dpage {
+  int ref;
+  int data[];
 };
 
 
 #define INTS(n) ((int*)calloc((n), sizeof(int)))
-#define WORDS(n) (calloc((n), sizeof(int)))
+#define PAGEBYTES(model) ((size_t)(model)->pagesize * 4)
 #define VM(a) ((struct VM *)(a))
+#define DISK(n) ((struct dpage **)calloc((n), sizeof(struct dpage *)))
+#define ALIGNUP(n, a) (((n) + (a) - 1) / (a) * (a))
+
+void init_policy(struct VM *model);
+void map_arena(struct VM *model);
+
+int in_arena(struct VM *model, void *p) {
+	return (char *)p >= model->arena && (char *)p < model->arena + model->arenasize;
+}
+
+// Free an array of model unless it lives in the arena.
+void release(struct VM *model, void *p) {
+	if (!in_arena(model, p)) {
+		free(p);
+	}
+}
+
+// Resize an array of model from old to size bytes, moving it out of the
+// arena if it is there.
+void *resize(struct VM *model, void *p, size_t old, size_t size) {
+	if (!in_arena(model, p)) {
+		return realloc(p, size);
+	}
+	return memcpy(malloc(size), p, old);
+}
+
+// Read and write entries of pvirt, ptlb and vtlb.
+int idx_get(struct VM *model, int *a, int i) {
+	if (!model->compact) {
+		return a[i];
+	}
+	int v = ((uint16_t *)a)[i];
+	return v == VM_COMPACT_NONE ? -1 : v;
+}
+
+void idx_set(struct VM *model, int *a, int i, int v) {
+	if (model->compact) {
+		((uint16_t *)a)[i] = (uint16_t)v;
+	} else {
+		a[i] = v;
+	}
+}
+
+// Read and write entries of ptime and tlbtime.
+int time_get(struct VM *model, int *a, int i) {
+	return model->compact ? model->tbase + ((uint16_t *)a)[i] : a[i];
+}
+
+void time_set(struct VM *model, int *a, int i, int t) {
+	if (model->compact) {
+		((uint16_t *)a)[i] = (uint16_t)(t - model->tbase);
+	} else {
+		a[i] = t;
+	}
+}
+
+int dirty_get(struct VM *model, int i) {
+	if (model->compact) {
+		return ((uint64_t *)model->dirty)[i >> 6] >> (i & 63) & 1;
+	}
+	return model->dirty[i];
+}
+
+void dirty_set(struct VM *model, int i, int v) {
+	if (!model->compact) {
+		model->dirty[i] = v;
+	} else if (v) {
+		((uint64_t *)model->dirty)[i >> 6] |= 1ULL << (i & 63);
+	} else {
+		((uint64_t *)model->dirty)[i >> 6] &= ~(1ULL << (i & 63));
+	}
+}
+
+// Index of the oldest of n times starting at base, relative to base.
+int mintime(struct VM *model, int *a, int base, int n) {
+	int value = 2147483647, index = -1;
+	for (int i = 0; i < n; i++) {
+		int t = model->compact ? ((uint16_t *)a)[base + i] : a[base + i];
+		if (t < value) {
+			value = t;
+			index = i;
+		}
+	}
+	return index;
+}
+
+// Replace the compact arrays by int arrays.
+void widen(struct VM *model) {
+	int *pvirt = INTS(model->ppage), *ptime = INTS(model->ppage), *dirty = INTS(model->ppage);
+	int *ptlb = INTS(model->tlb), *vtlb = INTS(model->tlb), *tlbtime = INTS(model->tlb);
+	int *freeframes = INTS(model->ppage);
+	for (int i = 0; i < model->ppage; i++) {
+		pvirt[i] = idx_get(model, model->pvirt, i);
+		freeframes[i] = idx_get(model, model->freeframes, i);
+		ptime[i] = time_get(model, model->ptime, i);
+		dirty[i] = dirty_get(model, i);
+	}
+	for (int i = 0; i < model->tlb; i++) {
+		ptlb[i] = idx_get(model, model->ptlb, i);
+		vtlb[i] = idx_get(model, model->vtlb, i);
+		tlbtime[i] = time_get(model, model->tlbtime, i);
+	}
+	int **fields[] = { &model->pvirt, &model->ptime, &model->dirty,
+	                   &model->ptlb, &model->vtlb, &model->tlbtime, &model->freeframes };
+	int *wide[] = { pvirt, ptime, dirty, ptlb, vtlb, tlbtime, freeframes };
+	for (int i = 0; i < 7; i++) {
+		release(model, *fields[i]);
+		*fields[i] = wide[i];
+	}
+	model->compact = 0;
+	model->tbase = 0;
+}
+
+// Compact times reach back this far exactly; older ones only keep their
+// order.
+int time_window(struct VM *model) {
+	return (VM_COMPACT_NONE - model->ppage - model->tlb) / 2;
+}
+
+int compare_ints(const void *a, const void *b) {
+	return *(const int *)a - *(const int *)b;
+}
+
+// The current time no longer fits in 16 bits above tbase. Move tbase up
+// so that the last time_window accesses keep their exact times, and give
+// older times consecutive values below them in the same order. Replacement
+// only compares times with each other or, in WSClock, ages with tau, so
+// this is invisible as long as tau is inside the window.
+void rebase_times(struct VM *model) {
+	int w = time_window(model);
+	if (model->palg == VM_WSCLOCK_REPLACEMENT && model->tau >= w) {
+		widen(model);
+		return;
+	}
+	uint16_t *t[2] = { (uint16_t *)model->ptime, (uint16_t *)model->tlbtime };
+	int len[2] = { model->ppage, model->tlb };
+	int cut = model->timestamp - w - model->tbase, k = 0;
+	int *old = INTS(model->ppage + model->tlb);
+	for (int a = 0; a < 2; a++) {
+		for (int i = 0; i < len[a]; i++) {
+			if (t[a][i] < cut) {
+				old[k++] = t[a][i];
+			}
+		}
+	}
+	qsort(old, k, sizeof(int), compare_ints);
+	int n = 0;
+	for (int i = 0; i < k; i++) {
+		if (n == 0 || old[i] != old[n - 1]) {
+			old[n++] = old[i];
+		}
+	}
+	for (int a = 0; a < 2; a++) {
+		for (int i = 0; i < len[a]; i++) {
+			int v = t[a][i];
+			if (v < cut) {
+				t[a][i] = (int *)bsearch(&v, old, n, sizeof(int), compare_ints) - old;
+			} else {
+				t[a][i] = v - cut + n;
+			}
+		}
+	}
+	model->tbase = model->timestamp - w - n;
+	free(old);
+}
+
+// Move the clock forward by n accesses.
+void advance(struct VM *model, int n) {
+	model->timestamp += n;
+	if (model->compact && model->timestamp - model->tbase > VM_COMPACT_NONE) {
+		rebase_times(model);
+	}
+}
+
 // createVM
 //
 // Create the virtual memory system and return a "handle" for it.
@@ -97,43 +389,138 @@ void *createVM(
   unsigned int sizePM,   // size of the physical memory in pages
   unsigned int pageSize, // size of a page in words
   unsigned int sizeTLB,  // number of translation lookaside buffer entries
-  char pageReplAlg,      // page replacement alg.: 0 is Round Robin, 1 is LRU
-  char tlbReplAlg        // TLB replacement alg.: 0 is Round Robin, 1 is LRU
+  char pageReplAlg,      // page replacement alg.: 0 is Round Robin, 1 is LRU,
+                         //   2 is WSClock, 3 is 2Q, 4 is LIRS
+  char tlbReplAlg        // TLB replacement alg.: 0 is Round Robin, 1 is LRU,
+                         //   2 is Random, 3 is tree-PLRU, 4 is bit-PLRU
   ) 
 {
+  if (sizeTLB == 0 ||
+      (tlbReplAlg == VM_TLB_TREE_PLRU_REPLACEMENT && (sizeTLB & (sizeTLB - 1)) != 0)) {
+	  return NULL;
+  }
   struct VM model = {
-	  .pagesize = pageSize, .vpage = sizeVM,
-	  .ppage = sizePM, .palg = pageReplAlg, .pvirt = INTS(sizePM), .ptime = INTS(sizePM), .dirty = INTS(sizePM),
-	  .tlb = sizeTLB,  .tlbalg = tlbReplAlg,  .ptlb = INTS(sizeTLB), .vtlb = INTS(sizeTLB), .tlbtime = INTS(sizeTLB),
+	  .pagesize = pageSize, .vpage = sizeVM, .npage = sizeVM, .pcap = sizeVM,
+	  .ppage = sizePM, .palg = pageReplAlg,
+	  .tlb = sizeTLB,  .tlbalg = tlbReplAlg,
 	  .pc = 0, .tc = 0, .dc = 0,
 	  .rrp = 0, .rrt = 0, .timestamp = 0,
-	  .mem = WORDS(sizePM * pageSize), 
-	  .disk = WORDS(sizeVM * pageSize),
+	  .tau = sizePM, .wshand = 0,
+	  .tlbways = sizeTLB, .tlbsets = 1,
+	  .tlbrng = VM_TLB_SEED,
+	  .disk = DISK(sizeVM),
+	  .hostpages = VM_HOST_PAGES_TRANSPARENT,
+	  .nspace = 1,
+	  .compact = sizeVM < VM_COMPACT_NONE && sizePM <= VM_COMPACT_LIMIT && sizeTLB <= VM_COMPACT_LIMIT,
   };
   
+  map_arena(&model);
+  if (model.vnode != NULL) {
+	  memset(model.vnode, 0xff, model.pcap * sizeof(int));
+  }
   for (int i = 0; i < sizePM; i++) {
-	  model.pvirt[i] = i;
+	  idx_set(&model, model.pvirt, i, i);
   }
+  init_policy(&model);
   for (int i = 0; i < sizeTLB; i++) {
-	  model.ptlb[i] = i;
-	  model.vtlb[i] = i;
+	  idx_set(&model, model.ptlb, i, i);
+	  idx_set(&model, model.vtlb, i, i);
   }
   struct VM *ret = (struct VM*)malloc(sizeof(model));
   *ret = model;
   return ret;
 }
 
+// The TLB is divided into tlbsets sets of tlbways entries each; a page
+// can only be cached in set pte % tlbsets. By default there is one set,
+// which makes the TLB fully associative.
+//
+// The pseudo-LRU algorithms keep their state in tlbbits, a bitset of one
+// bit per entry that only they allocate. Tree-PLRU keeps a binary tree of
+// ways - 1 bits per set, stored heap-style from the first entry of the
+// set, where each bit points to the half of the set that was used less
+// recently. Bit-PLRU keeps one bit per entry that is set when the entry
+// is used, and tlbset counts the bits set in each set; once every bit of
+// a set is set, all but the newest are cleared.
+int tlb_base(struct VM *model, int pte) {
+	return pte % model->tlbsets * model->tlbways;
+}
+
+int uses_tlbbits(struct VM *model) {
+	return model->tlbalg == VM_TLB_TREE_PLRU_REPLACEMENT ||
+	       model->tlbalg == VM_TLB_BIT_PLRU_REPLACEMENT;
+}
+
+int tlbbit_get(struct VM *model, int i) {
+	return model->tlbbits[i >> 6] >> (i & 63) & 1;
+}
+
+void tlbbit_set(struct VM *model, int i, int v) {
+	if (v) {
+		model->tlbbits[i >> 6] |= 1ULL << (i & 63);
+	} else {
+		model->tlbbits[i >> 6] &= ~(1ULL << (i & 63));
+	}
+}
+
+void tlb_touch(struct VM *model, int index) {
+	int set = index / model->tlbways, base = set * model->tlbways;
+	if (model->tlbalg == VM_TLB_TREE_PLRU_REPLACEMENT) {
+		int lo = 0, hi = model->tlbways, node = 1, way = index - base;
+		while (hi - lo > 1) {
+			int mid = (lo + hi) / 2;
+			if (way < mid) {
+				tlbbit_set(model, base + node - 1, 1);
+				hi = mid;
+				node = 2 * node;
+			} else {
+				tlbbit_set(model, base + node - 1, 0);
+				lo = mid;
+				node = 2 * node + 1;
+			}
+		}
+	} else if (model->tlbalg == VM_TLB_BIT_PLRU_REPLACEMENT && !tlbbit_get(model, index)) {
+		tlbbit_set(model, index, 1);
+		if (++model->tlbset[set] == model->tlbways) {
+			for (int i = base; i < base + model->tlbways; i++) {
+				tlbbit_set(model, i, i == index);
+			}
+			model->tlbset[set] = 1;
+		}
+	}
+}
+
 int lookup_in_tlb_and_mark(struct VM *model, int pte) {
-	for (int i = 0; i < model->tlb; i++) {
-		if (model->vtlb[i] == pte) {
-			model->tlbtime[i] = model->timestamp;
-			return model->ptlb[i];
+	int base = tlb_base(model, pte);
+	int i = base, end = base + model->tlbways;
+	if (model->compact) {
+		uint16_t *vtlb = (uint16_t *)model->vtlb;
+		while (i < end && vtlb[i] != pte) {
+			i++;
+		}
+	} else {
+		while (i < end && model->vtlb[i] != pte) {
+			i++;
 		}
 	}
-	return -1;
+	if (i == end) {
+		return -1;
+	}
+	time_set(model, model->tlbtime, i, model->timestamp);
+	tlb_touch(model, i);
+	return idx_get(model, model->ptlb, i);
 }
 
 int lookup_in_mem(struct VM *model, int pte) {
+	if (model->compact) {
+		uint16_t *pvirt = (uint16_t *)model->pvirt;
+		for (int i = 0; i < model->ppage; i++) {
+			if (pvirt[i] == pte) {
+				return i;
+			}
+		}
+		return -1;
+	}
 	for (int i = 0; i < model->ppage; i++) {
 		if (model->pvirt[i] == pte) {
 			return i;
@@ -143,202 +530,3998 @@ int lookup_in_mem(struct VM *model, int pte) {
 }
 
 void *make_address(struct VM *model, int index, int add) {
-	return model->mem + index * model->pagesize * 4 + add * 4;
+	return model->mem + index * PAGEBYTES(model) + (size_t)add * 4;
+}
+
+int frame_tier(struct VM *model, int frame) {
+	int t = 0;
+	while (frame >= model->tierbase[t + 1]) {
+		t++;
+	}
+	return t;
 }
 
 void mark(struct VM *model, int pte, int dirty) {
 	if (dirty) {
-		model->dirty[pte] = 1;
+		dirty_set(model, pte, 1);
+	}
+	time_set(model, model->ptime, pte, model->timestamp);
+	if (model->ntier) {
+		int t = frame_tier(model, pte);
+		model->heat[pte]++;
+		model->tierhits[t]++;
+		model->latency += model->tierlat[t];
 	}
-	model->ptime[pte] = model->timestamp;
 }
 
-int minindex(int *p, int n) {
-	int value = 2147483647, index = -1;
-	for (int i = 0; i < n; i++) {
-		if (p[i] < value) {
-			value = p[i];
-			index = i;
+void release_dpage(struct dpage *page) {
+	if (page != NULL && --page->ref == 0) {
+		free(page);
+	}
+}
+
+// Record that the disk entry of pte is about to become not NULL.
+void disk_used(struct VM *model, int pte) {
+	if (model->ndused == model->dcap) {
+		model->dcap = model->dcap > 0 ? 2 * model->dcap : 64;
+		model->dused = realloc(model->dused, model->dcap * sizeof(int));
+	}
+	model->dused[model->ndused++] = pte;
+}
+
+// Forget the disk contents of pte, which reads as zeros again.
+void disk_discard(struct VM *model, int pte) {
+	if (model->disk[pte] == NULL) {
+		return;
+	}
+	release_dpage(model->disk[pte]);
+	model->disk[pte] = NULL;
+	for (int i = model->ndused - 1; i >= 0; i--) {
+		if (model->dused[i] == pte) {
+			model->dused[i] = model->dused[--model->ndused];
+			break;
 		}
 	}
-	return index;
 }
 
-int choose_page(struct VM *model) {
-	if (model->palg == 0) {
-		model->rrp++;
-		model->rrp %= model->ppage;
-		return (model->rrp + model->ppage - 1) % model->ppage;
+void disk_write(struct VM *model, int pte, void *src) {
+	struct dpage *page = model->disk[pte];
+	if (page == NULL) {
+		disk_used(model, pte);
+	}
+	if (page == NULL || page->ref > 1) {
+		release_dpage(page);
+		page = malloc(sizeof(struct dpage) + PAGEBYTES(model));
+		page->ref = 1;
+		model->disk[pte] = page;
+	}
+	memcpy(page->data, src, PAGEBYTES(model));
+}
+
+void disk_read(struct VM *model, int pte, void *dst) {
+	struct dpage *page = model->disk[pte];
+	if (page == NULL) {
+		memset(dst, 0, PAGEBYTES(model));
 	} else {
-		return minindex(model->ptime, model->ppage);
+		memcpy(dst, page->data, PAGEBYTES(model));
 	}
 }
 
-int choose_tlb(struct VM *model) {
-	if (model->tlbalg == 0) {
-		model->rrt++;
-		model->rrt %= model->tlb;
-		return (model->rrt + model->tlb - 1) % model->tlb;
+// 2Q list roles, all linked through link[0]: A1in is a FIFO of pages seen
+// once, Am an LRU of pages seen again, and A1out a bounded FIFO of pages
+// recently evicted from A1in.
+#define Q_A1IN 0
+#define Q_AM 1
+#define Q_A1OUT 2
+
+// LIRS list roles: the stack S is linked through link[0]; the queue of
+// resident HIR pages Q and the FIFO of non-resident HIR pages NR are
+// linked through link[1].
+#define LIRS_S 0
+#define LIRS_Q 1
+#define LIRS_NR 2
+#define LIRS_LIR 0
+#define LIRS_HIR 1
+
+#define PREV 0
+#define NEXT 1
+
+void list_remove(struct VM *model, int l, int n, int set) {
+	struct qnode *x = &model->nodes[n];
+	struct qlist *list = &model->lists[l];
+	if (x->link[set][PREV] != -1) {
+		model->nodes[x->link[set][PREV]].link[set][NEXT] = x->link[set][NEXT];
 	} else {
-		return minindex(model->tlbtime, model->tlb);
+		list->head = x->link[set][NEXT];
 	}
+	if (x->link[set][NEXT] != -1) {
+		model->nodes[x->link[set][NEXT]].link[set][PREV] = x->link[set][PREV];
+	} else {
+		list->tail = x->link[set][PREV];
+	}
+	list->len--;
 }
 
-void addtlb(struct VM *model, int mem, int pte) {
-	int index = choose_tlb(model);
-	model->ptlb[index] = mem;
-	model->vtlb[index] = pte;
-	model->tlbtime[index] = model->timestamp;
+void list_push(struct VM *model, int l, int n, int set) {
+	struct qnode *x = &model->nodes[n];
+	struct qlist *list = &model->lists[l];
+	x->link[set][PREV] = -1;
+	x->link[set][NEXT] = list->head;
+	if (list->head != -1) {
+		model->nodes[list->head].link[set][PREV] = n;
+	} else {
+		list->tail = n;
+	}
+	list->head = n;
+	list->len++;
 }
 
-void flushtlb(struct VM *model, int mem, int pte) {
-	for (int i = 0; i < model->tlb; i++) {
-		if (model->ptlb[i] == mem) {
-			model->vtlb[i] = pte;
-			return;
+void list_append(struct VM *model, int l, int n, int set) {
+	struct qnode *x = &model->nodes[n];
+	struct qlist *list = &model->lists[l];
+	x->link[set][NEXT] = -1;
+	x->link[set][PREV] = list->tail;
+	if (list->tail != -1) {
+		model->nodes[list->tail].link[set][NEXT] = n;
+	} else {
+		list->head = n;
+	}
+	list->tail = n;
+	list->len++;
+}
+
+int node_alloc(struct VM *model, int page, int frame) {
+	int n = model->nfree;
+	model->nfree = model->nodes[n].link[0][NEXT];
+	model->nodes[n] = (struct qnode){ .page = page, .frame = frame };
+	model->vnode[page] = n;
+	return n;
+}
+
+void node_free(struct VM *model, int n) {
+	model->vnode[model->nodes[n].page] = -1;
+	model->nodes[n].link[0][NEXT] = model->nfree;
+	model->nfree = n;
+}
+
+// 2Q: a page seen once is replaced in FIFO order from A1in, so a scan
+// cannot flush the pages in Am. A page faulted in again while it is
+// remembered in A1out has proven itself and goes to Am.
+int twoq_choose(struct VM *model) {
+	int kin = model->ppage / 4 > 0 ? model->ppage / 4 : 1;
+	int kout = model->ppage / 2 > 0 ? model->ppage / 2 : 1;
+	if (model->lists[Q_A1IN].len > kin || model->lists[Q_AM].len == 0) {
+		int n = model->lists[Q_A1IN].tail;
+		int frame = model->nodes[n].frame;
+		list_remove(model, Q_A1IN, n, 0);
+		model->nodes[n].state = Q_A1OUT;
+		model->nodes[n].frame = -1;
+		list_push(model, Q_A1OUT, n, 0);
+		if (model->lists[Q_A1OUT].len > kout) {
+			int old = model->lists[Q_A1OUT].tail;
+			list_remove(model, Q_A1OUT, old, 0);
+			node_free(model, old);
 		}
+		return frame;
 	}
-	addtlb(model, mem, pte);
+	int n = model->lists[Q_AM].tail;
+	int frame = model->nodes[n].frame;
+	list_remove(model, Q_AM, n, 0);
+	node_free(model, n);
+	return frame;
 }
 
-void *real_address(struct VM *model, unsigned int address, int dirty) {
-	model->timestamp++;
-	int pte  = address / model->pagesize;
-	int add  = address % model->pagesize;
-	int mem = lookup_in_tlb_and_mark(model, pte);
-	if (mem != -1) {
-		mark(model, mem, dirty);
-		return make_address(model, mem, add);
+void twoq_fill(struct VM *model, int frame, int pte) {
+	int n = model->vnode[pte];
+	if (n != -1) {
+		list_remove(model, Q_A1OUT, n, 0);
+		model->nodes[n].state = Q_AM;
+		model->nodes[n].frame = frame;
+		list_push(model, Q_AM, n, 0);
+	} else {
+		n = node_alloc(model, pte, frame);
+		model->nodes[n].state = Q_A1IN;
+		list_push(model, Q_A1IN, n, 0);
 	}
-	model->tc++;
-	mem = lookup_in_mem(model, pte);
-	if (mem != -1) {
-		mark(model, mem, dirty);
-		addtlb(model, mem, pte);
-		return make_address(model, mem, add);
+}
+
+void twoq_hit(struct VM *model, int n) {
+	if (model->nodes[n].state == Q_AM) {
+		list_remove(model, Q_AM, n, 0);
+		list_push(model, Q_AM, n, 0);
 	}
-	model->pc++;
-	mem = choose_page(model);
-	if (model->dirty[mem]) {
-		model->dc++;
-		memcpy(model->disk + model->pvirt[mem] * model->pagesize * 4,
-		       model->mem  + mem * model->pagesize * 4,
-			   model->pagesize * 4);
-	}
-	model->pvirt[mem] = pte;
-	model->ptime[mem] = model->timestamp;
-	model->dirty[mem] = 0;
-	memcpy(model->mem  + mem * model->pagesize * 4,
-	       model->disk + model->pvirt[mem] * model->pagesize * 4,
-		   model->pagesize * 4);
-	flushtlb(model, mem, pte);
-	mark(model, mem, dirty);
-	return make_address(model, mem, add);
 }
 
-void *read_address(struct VM *model, unsigned int address) {
-	return real_address(model, address, 0);
+// LIRS: pages are LIR (low inter-reference recency) or HIR. The LIR pages
+// hold llir frames and are only replaced by being demoted; victims come
+// from the front of Q, the resident HIR pages. The stack S orders pages by
+// recency and is pruned so that its bottom is always a LIR page. A HIR
+// page referenced while still in S has a shorter reuse distance than the
+// bottom LIR page and swaps roles with it. Non-resident HIR pages are kept
+// in S to detect this, at most ppage of them.
+void lirs_prune(struct VM *model) {
+	while (model->lists[LIRS_S].len > 0) {
+		int n = model->lists[LIRS_S].tail;
+		struct qnode *x = &model->nodes[n];
+		if (x->state == LIRS_LIR) {
+			break;
+		}
+		list_remove(model, LIRS_S, n, 0);
+		x->ins = 0;
+		if (x->frame == -1) {
+			list_remove(model, LIRS_NR, n, 1);
+			node_free(model, n);
+		}
+	}
 }
 
-void write_address(struct VM *model, unsigned int address, void *value) {
-	memcpy(real_address(model, address, 1), value, 4);
+void lirs_demote_bottom(struct VM *model) {
+	int n = model->lists[LIRS_S].tail;
+	list_remove(model, LIRS_S, n, 0);
+	model->nodes[n].ins = 0;
+	model->nodes[n].state = LIRS_HIR;
+	list_append(model, LIRS_Q, n, 1);
+	model->nlir--;
+	lirs_prune(model);
 }
 
-// readInt
-//
-// Read an int from virtual memory.
-//
-// If the handle is not one returned by createVM, the behavior is
-// undefined.
-//
-// If the address is out of range, an error message will be printed to
-// stderr and the program will be terminated.
-//
-int readInt(void *handle, unsigned int address) {
-	return *(int *)read_address(VM(handle), address);
+void lirs_make_lir(struct VM *model, int n) {
+	model->nodes[n].state = LIRS_LIR;
+	model->nlir++;
+	if (model->nlir > model->llir) {
+		lirs_demote_bottom(model);
+	}
 }
 
-// readFloat
-//
-// Read a float from virtual memory.
-//
-// If the handle is not one returned by createVM, the behavior is
-// undefined.
-//
-// If the address is out of range, an error message will be printed to
-// stderr and the program will be terminated.
-//
-float readFloat(void *handle, unsigned int address) {
-	return *(float *)read_address(VM(handle), address);
+int lirs_choose(struct VM *model) {
+	if (model->lists[LIRS_Q].len == 0) {
+		lirs_demote_bottom(model);
+	}
+	int n = model->lists[LIRS_Q].head;
+	struct qnode *x = &model->nodes[n];
+	int frame = x->frame;
+	list_remove(model, LIRS_Q, n, 1);
+	if (!x->ins) {
+		node_free(model, n);
+		return frame;
+	}
+	x->frame = -1;
+	list_append(model, LIRS_NR, n, 1);
+	if (model->lists[LIRS_NR].len > model->ppage) {
+		int old = model->lists[LIRS_NR].head;
+		list_remove(model, LIRS_NR, old, 1);
+		list_remove(model, LIRS_S, old, 0);
+		node_free(model, old);
+	}
+	return frame;
 }
 
-// writeInt
-//
-// Write an int to virtual memory.
-//
-// If the handle is not one returned by createVM, the behavior is
-// undefined.
-//
-// If the address is out of range, an error message will be printed to
-// stderr and the program will be terminated.
-//
-void writeInt(void *handle, unsigned int address, int value) {
-	write_address(VM(handle), address, &value);
+void lirs_fill(struct VM *model, int frame, int pte) {
+	int n = model->vnode[pte];
+	if (n != -1) {
+		list_remove(model, LIRS_NR, n, 1);
+		list_remove(model, LIRS_S, n, 0);
+		list_push(model, LIRS_S, n, 0);
+		model->nodes[n].frame = frame;
+		lirs_make_lir(model, n);
+		return;
+	}
+	n = node_alloc(model, pte, frame);
+	model->nodes[n].ins = 1;
+	list_push(model, LIRS_S, n, 0);
+	if (model->nlir < model->llir) {
+		model->nodes[n].state = LIRS_LIR;
+		model->nlir++;
+	} else {
+		model->nodes[n].state = LIRS_HIR;
+		list_append(model, LIRS_Q, n, 1);
+	}
 }
 
-// writeFloat
-//
-// Write a float to virtual memory.
-//
-// If the handle is not one returned by createVM, the behavior is
-// undefined.
-//
-// If the address is out of range, an error message will be printed to
-// stderr and the program will be terminated.
-//
-void writeFloat(void *handle, unsigned int address, float value) {
-	write_address(VM(handle), address, &value);
+void lirs_hit(struct VM *model, int n) {
+	struct qnode *x = &model->nodes[n];
+	if (model->lists[LIRS_S].head == n) {
+		// A repeated reference to the most recent page carries no reuse
+		// distance information.
+		return;
+	}
+	if (x->state == LIRS_LIR) {
+		int bottom = model->lists[LIRS_S].tail == n;
+		list_remove(model, LIRS_S, n, 0);
+		list_push(model, LIRS_S, n, 0);
+		if (bottom) {
+			lirs_prune(model);
+		}
+	} else if (x->ins) {
+		list_remove(model, LIRS_S, n, 0);
+		list_push(model, LIRS_S, n, 0);
+		list_remove(model, LIRS_Q, n, 1);
+		lirs_make_lir(model, n);
+	} else {
+		x->ins = 1;
+		list_push(model, LIRS_S, n, 0);
+		list_remove(model, LIRS_Q, n, 1);
+		list_append(model, LIRS_Q, n, 1);
+	}
 }
 
-// printStatistics
-//
-// Print the total number of page faults, the total number of TLB misses
-// and the total number of disk writes.
-//
-// If the handle is not one returned by createVM, the behavior is
-// undefined.
-//
-// Here is a sample output:
-//
-//   Number of page faults: 123
-//   Number of TLB misses: 125
-//   Number of disk writes: 64
-//
-void printStatistics(void *handle) {
-	printf("Number of page faults: %d\n"
-		   "Number of TLB misses: %d\n"
-           "Number of disk writes: %d\n", 
-	       VM(handle)->pc, 
-	       VM(handle)->tc,
-	       VM(handle)->dc);
+int uses_nodes(struct VM *model) {
+	return model->palg == VM_2Q_REPLACEMENT || model->palg == VM_LIRS_REPLACEMENT;
+}
 
+// Set up an empty node pool. The pool and vnode are reused if they
+// exist, in which case vnode must already be all -1.
+void init_nodes(struct VM *model) {
+	int n = 2 * model->ppage + 2;
+	if (model->nodes == NULL) {
+		model->nodes = (struct qnode *)calloc(n, sizeof(struct qnode));
+		model->vnode = INTS(model->pcap);
+		for (int i = 0; i < model->pcap; i++) {
+			model->vnode[i] = -1;
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		model->nodes[i].link[0][NEXT] = i + 1 < n ? i + 1 : -1;
+	}
+	model->nfree = 0;
+	for (int i = 0; i < 3; i++) {
+		model->lists[i] = (struct qlist){ -1, -1, 0 };
+	}
+	model->nlir = 0;
+	model->llir = model->ppage - (model->ppage / 100 > 0 ? model->ppage / 100 : 1);
 }
 
-// cleanupVM
-//
-// Cleanup the memory used by the simulation of the virtual memory system.
+// Tell the replacement algorithm that a page was referenced, or that
+// a page was loaded into a frame.
+void page_hit(struct VM *model, int frame) {
+	if (model->npinned && model->pinned[frame]) {
+		return;
+	} else if (model->palg == VM_2Q_REPLACEMENT) {
+		twoq_hit(model, model->vnode[idx_get(model, model->pvirt, frame)]);
+	} else if (model->palg == VM_LIRS_REPLACEMENT) {
+		lirs_hit(model, model->vnode[idx_get(model, model->pvirt, frame)]);
+	}
+}
+
+// The page in frame leaves physical memory without being replaced.
+void page_drop(struct VM *model, int frame) {
+	if (!uses_nodes(model)) {
+		return;
+	}
+	int n = model->vnode[idx_get(model, model->pvirt, frame)];
+	struct qnode *x = &model->nodes[n];
+	if (model->palg == VM_2Q_REPLACEMENT) {
+		list_remove(model, x->state, n, 0);
+	} else if (x->state == LIRS_LIR) {
+		list_remove(model, LIRS_S, n, 0);
+		model->nlir--;
+	} else {
+		list_remove(model, LIRS_Q, n, 1);
+		if (x->ins) {
+			list_remove(model, LIRS_S, n, 0);
+		}
+	}
+	node_free(model, n);
+	if (model->palg == VM_LIRS_REPLACEMENT) {
+		lirs_prune(model);
+	}
+}
+
+void page_fill(struct VM *model, int frame, int pte) {
+	if (model->palg == VM_2Q_REPLACEMENT) {
+		twoq_fill(model, frame, pte);
+	} else if (model->palg == VM_LIRS_REPLACEMENT) {
+		lirs_fill(model, frame, pte);
+	}
+}
+
+// Set up the replacement algorithm's own state for the pages resident in
+// the initial state.
+void init_policy(struct VM *model) {
+	if (uses_nodes(model)) {
+		init_nodes(model);
+		for (int i = 0; i < model->ppage; i++) {
+			if (idx_get(model, model->pvirt, i) != -1) {
+				page_fill(model, i, idx_get(model, model->pvirt, i));
+			}
+		}
+	}
+}
+
+// Pinned frames are never chosen as victims. pinnext links each pinned
+// frame to the frame after it, so following it from any frame, with path
+// compression, finds the next unpinned frame; pinnext[ppage] is ppage.
+int next_unpinned(struct VM *model, int frame) {
+	if (model->npinned == 0) {
+		return frame;
+	}
+	int root = frame;
+	while (model->pinnext[root] != root) {
+		root = model->pinnext[root];
+	}
+	while (model->pinnext[frame] != root) {
+		int next = model->pinnext[frame];
+		model->pinnext[frame] = root;
+		frame = next;
+	}
+	return root;
+}
+
+int next_unpinned_cyclic(struct VM *model, int frame) {
+	frame = next_unpinned(model, frame);
+	return frame < model->ppage ? frame : next_unpinned(model, 0);
+}
+
+// The first frame from frame on, cyclically, that holds a page that may
+// be replaced.
+int next_victim(struct VM *model, int frame) {
+	frame = next_unpinned_cyclic(model, frame);
+	while (model->nfreeframes > 0 && idx_get(model, model->pvirt, frame) == -1) {
+		frame = next_unpinned_cyclic(model, (frame + 1) % model->ppage);
+	}
+	return frame;
+}
+
+void link_pinned(struct VM *model) {
+	for (int i = 0; i < model->ppage; i++) {
+		model->pinnext[i] = model->pinned[i] ? i + 1 : i;
+	}
+	model->pinnext[model->ppage] = model->ppage;
+}
+
+// The least recently used page that may be replaced.
+int oldest_frame(struct VM *model) {
+	if (model->npinned == 0 && model->nfreeframes == 0) {
+		return mintime(model, model->ptime, 0, model->ppage);
+	}
+	int value = 2147483647, index = -1;
+	for (int i = next_unpinned(model, 0); i < model->ppage; i = next_unpinned(model, i + 1)) {
+		int t = time_get(model, model->ptime, i);
+		if (t < value && idx_get(model, model->pvirt, i) != -1) {
+			value = t;
+			index = i;
+		}
+	}
+	return index;
+}
+
+// Whether the page in frame was referenced in the last tau accesses,
+// which makes it part of the working set.
+int in_working_set(struct VM *model, int frame) {
+	return model->timestamp - time_get(model, model->ptime, frame) < model->tau;
+}
+
+// WSClock: sweep the frames with a clock hand. A page that has not been
+// referenced in the last tau accesses has left the working set; if it is
+// clean it is the victim, if it is dirty it is written back so that a
+// later sweep can take it. If a whole sweep finds no clean page outside
+// the working set, the first page written back (or failing that the least
+// recently used page) is taken.
+int wsclock(struct VM *model) {
+	int cleaned = -1;
+	for (int n = model->npinned + model->nfreeframes; n < model->ppage; n++) {
+		int i = next_victim(model, model->wshand);
+		model->wshand = (i + 1) % model->ppage;
+		if (in_working_set(model, i)) {
+			continue;
+		}
+		if (!dirty_get(model, i)) {
+			return i;
+		}
+		model->dc++;
+		disk_write(model, idx_get(model, model->pvirt, i), make_address(model, i, 0));
+		dirty_set(model, i, 0);
+		if (cleaned == -1) {
+			cleaned = i;
+		}
+	}
+	return cleaned != -1 ? cleaned : oldest_frame(model);
+}
+
+int choose_page(struct VM *model) {
+	if (model->palg == VM_ROUNDROBIN_REPLACEMENT) {
+		int victim = next_victim(model, model->rrp);
+		model->rrp = (victim + 1) % model->ppage;
+		return victim;
+	} else if (model->palg == VM_WSCLOCK_REPLACEMENT) {
+		return wsclock(model);
+	} else if (model->palg == VM_2Q_REPLACEMENT) {
+		return twoq_choose(model);
+	} else if (model->palg == VM_LIRS_REPLACEMENT) {
+		return lirs_choose(model);
+	} else {
+		return oldest_frame(model);
+	}
+}
+
+// The resident working set: pages referenced in the last tau accesses.
+int working_set_size(struct VM *model) {
+	int n = 0;
+	for (int i = 0; i < model->ppage; i++) {
+		if (in_working_set(model, i) && idx_get(model, model->pvirt, i) != -1) {
+			n++;
+		}
+	}
+	return n;
+}
+
+void sample_working_set(struct VM *model) {
+	int n = working_set_size(model);
+	model->wssum += n;
+	model->wsn++;
+	if (n > model->wsmax) {
+		model->wsmax = n;
+	}
+}
+
+// TinyLFU admission: a count-min sketch estimates how often each page was
+// accessed recently, and an incoming page or TLB entry only displaces a
+// victim that it has been accessed more often than. The sketch has
+// VM_SKETCH_ROWS rows of 4-bit counters, which are halved after every
+// VM_SKETCH_SAMPLE accesses per counter so that old history fades.
+#define VM_SKETCH_ROWS 4
+#define VM_SKETCH_MAX 15
+#define VM_SKETCH_SAMPLE 10
+
+int sketch_slot(struct VM *model, int row, int pte) {
+	static const uint64_t seeds[VM_SKETCH_ROWS] = {
+	  0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL,
+	  0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL,
+	};
+	uint64_t h = ((uint64_t)pte + 1) * seeds[row];
+	return (row << model->sketchbits) + (int)(h >> (64 - model->sketchbits));
+}
+
+int sketch_freq(struct VM *model, int pte) {
+	int f = VM_SKETCH_MAX;
+	for (int r = 0; r < VM_SKETCH_ROWS; r++) {
+		int c = model->sketch[sketch_slot(model, r, pte)];
+		if (c < f) {
+			f = c;
+		}
+	}
+	return f;
+}
+
+void sketch_record(struct VM *model, int pte) {
+	for (int r = 0; r < VM_SKETCH_ROWS; r++) {
+		unsigned char *c = &model->sketch[sketch_slot(model, r, pte)];
+		if (*c < VM_SKETCH_MAX) {
+			(*c)++;
+		}
+	}
+	if (++model->sketchn >= (long)VM_SKETCH_SAMPLE << model->sketchbits) {
+		for (int i = 0; i < VM_SKETCH_ROWS << model->sketchbits; i++) {
+			model->sketch[i] >>= 1;
+		}
+		model->sketchn /= 2;
+	}
+}
+
+uint64_t next_random(uint64_t *state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+// Choose the entry to replace in the set starting at base. An invalid
+// entry (vtlb of -1) is always taken first.
+int choose_tlb(struct VM *model, int base) {
+	int ways = model->tlbways, set = base / ways;
+	for (int i = base; i < base + ways; i++) {
+		if (idx_get(model, model->vtlb, i) == -1) {
+			return i;
+		}
+	}
+	if (model->tlbalg == VM_ROUNDROBIN_REPLACEMENT && model->tlbsets == 1) {
+		model->rrt++;
+		model->rrt %= model->tlb;
+		return (model->rrt + model->tlb - 1) % model->tlb;
+	} else if (model->tlbalg == VM_ROUNDROBIN_REPLACEMENT) {
+		model->tlbset[set]++;
+		model->tlbset[set] %= ways;
+		return base + (model->tlbset[set] + ways - 1) % ways;
+	} else if (model->tlbalg == VM_TLB_RANDOM_REPLACEMENT) {
+		return base + next_random(&model->tlbrng) % ways;
+	} else if (model->tlbalg == VM_TLB_TREE_PLRU_REPLACEMENT) {
+		int lo = 0, hi = ways, node = 1;
+		while (hi - lo > 1) {
+			int mid = (lo + hi) / 2;
+			if (tlbbit_get(model, base + node - 1)) {
+				lo = mid;
+				node = 2 * node + 1;
+			} else {
+				hi = mid;
+				node = 2 * node;
+			}
+		}
+		return base + lo;
+	} else if (model->tlbalg == VM_TLB_BIT_PLRU_REPLACEMENT) {
+		for (int i = 0; i < ways; i++) {
+			if (!tlbbit_get(model, base + i)) {
+				return base + i;
+			}
+		}
+		return base;
+	} else {
+		return base + mintime(model, model->tlbtime, base, ways);
+	}
+}
+
+// The entry of a page locked with its translation is passed over for the
+// next entry of the set that is not, if there is one.
+int unpinned_entry(struct VM *model, int base, int index) {
+	for (int n = 0; n < model->tlbways && model->npinned; n++) {
+		int i = base + (index - base + n) % model->tlbways;
+		if (idx_get(model, model->vtlb, i) == -1 ||
+		    model->pinned[idx_get(model, model->ptlb, i)] != VM_PIN_TLB) {
+			return i;
+		}
+	}
+	return index;
+}
+
+void addtlb(struct VM *model, int mem, int pte) {
+	int base = tlb_base(model, pte), set = base / model->tlbways;
+	int rrt = model->rrt, rrs = model->tlbset[set];
+	int index = unpinned_entry(model, base, choose_tlb(model, base));
+	int old = idx_get(model, model->vtlb, index);
+	if (model->admittlb && old != -1 && sketch_freq(model, pte) <= sketch_freq(model, old)) {
+		model->rrt = rrt;
+		model->tlbset[set] = rrs;
+		model->rejtlb++;
+		return;
+	}
+	idx_set(model, model->ptlb, index, mem);
+	idx_set(model, model->vtlb, index, pte);
+	time_set(model, model->tlbtime, index, model->timestamp);
+	tlb_touch(model, index);
+}
+
+// Frame mem now holds page pte. A fully associative TLB reuses the entry
+// of the page that was replaced; otherwise that entry is invalidated and
+// the new page is cached in its own set. Unless fill is set, the entry is
+// only invalidated and pte is not cached.
+void flushtlb(struct VM *model, int mem, int pte, int fill) {
+	for (int i = 0; i < model->tlb; i++) {
+		if (idx_get(model, model->ptlb, i) == mem && idx_get(model, model->vtlb, i) != -1) {
+			if (fill && model->tlbsets == 1) {
+				idx_set(model, model->vtlb, i, pte);
+				return;
+			}
+			idx_set(model, model->vtlb, i, -1);
+			break;
+		}
+	}
+	if (fill) {
+		addtlb(model, mem, pte);
+	}
+}
+
+// Once replacement is scoped, frames are charged to the address space
+// that loaded their page, as a memory cgroup charges them. The frames
+// charged to address space s form a list through fnext and fprev from
+// ohead[s], the first loaded, to otail[s], and ocount[s] counts them.
+void charge(struct VM *model, int frame, int space) {
+	model->fowner[frame] = space;
+	model->fnext[frame] = -1;
+	model->fprev[frame] = model->otail[space];
+	if (model->otail[space] != -1) {
+		model->fnext[model->otail[space]] = frame;
+	} else {
+		model->ohead[space] = frame;
+	}
+	model->otail[space] = frame;
+	model->ocount[space]++;
+}
+
+void uncharge(struct VM *model, int frame) {
+	if (model->fowner == NULL || model->fowner[frame] == -1) {
+		return;
+	}
+	int space = model->fowner[frame];
+	if (model->fprev[frame] != -1) {
+		model->fnext[model->fprev[frame]] = model->fnext[frame];
+	} else {
+		model->ohead[space] = model->fnext[frame];
+	}
+	if (model->fnext[frame] != -1) {
+		model->fprev[model->fnext[frame]] = model->fprev[frame];
+	} else {
+		model->otail[space] = model->fprev[frame];
+	}
+	model->fowner[frame] = -1;
+	model->ocount[space]--;
+}
+
+// Exchange the pages held by two frames, together with their page
+// table state and any TLB entries that point at them.
+void swap_frames(struct VM *model, int a, int b) {
+	int *pa = make_address(model, a, 0), *pb = make_address(model, b, 0);
+	for (int i = 0; i < model->pagesize; i++) {
+		int w = pa[i];
+		pa[i] = pb[i];
+		pb[i] = w;
+	}
+	int v = idx_get(model, model->pvirt, a);
+	idx_set(model, model->pvirt, a, idx_get(model, model->pvirt, b));
+	idx_set(model, model->pvirt, b, v);
+	v = time_get(model, model->ptime, a);
+	time_set(model, model->ptime, a, time_get(model, model->ptime, b));
+	time_set(model, model->ptime, b, v);
+	v = dirty_get(model, a);
+	dirty_set(model, a, dirty_get(model, b));
+	dirty_set(model, b, v);
+	v = model->heat[a];
+	model->heat[a] = model->heat[b];
+	model->heat[b] = v;
+	if (model->pinned != NULL && model->pinned[a] != model->pinned[b]) {
+		v = model->pinned[a];
+		model->pinned[a] = model->pinned[b];
+		model->pinned[b] = v;
+		link_pinned(model);
+	}
+	if (model->fowner != NULL && model->fowner[a] != model->fowner[b]) {
+		int oa = model->fowner[a], ob = model->fowner[b];
+		uncharge(model, a);
+		uncharge(model, b);
+		if (ob != -1) {
+			charge(model, a, ob);
+		}
+		if (oa != -1) {
+			charge(model, b, oa);
+		}
+	}
+	for (int i = 0; i < model->tlb; i++) {
+		if (idx_get(model, model->ptlb, i) == a) {
+			idx_set(model, model->ptlb, i, b);
+		} else if (idx_get(model, model->ptlb, i) == b) {
+			idx_set(model, model->ptlb, i, a);
+		}
+	}
+	for (int i = 0; i < model->nfreeframes; i++) {
+		int f = idx_get(model, model->freeframes, i);
+		if (f == a || f == b) {
+			idx_set(model, model->freeframes, i, f == a ? b : a);
+		}
+	}
+	for (int i = 0; i < 2 && uses_nodes(model); i++) {
+		int frame = i ? b : a, page = idx_get(model, model->pvirt, frame);
+		if (page != -1 && model->vnode[page] != -1) {
+			model->nodes[model->vnode[page]].frame = frame;
+		}
+	}
+}
+
+// Move the hottest pages of each tier into the tier above it while they
+// are hotter than the coldest page there, then age all heat counters.
+void migrate_tiers(struct VM *model) {
+	for (int t = 0; t + 1 < model->ntier; t++) {
+		for (int n = 0; n < VM_TIER_MIGRATE_BATCH; n++) {
+			int hot = model->tierbase[t + 1], cold = model->tierbase[t];
+			for (int i = hot; i < model->tierbase[t + 2]; i++) {
+				if (model->heat[i] > model->heat[hot]) {
+					hot = i;
+				}
+			}
+			for (int i = cold; i < model->tierbase[t + 1]; i++) {
+				if (model->heat[i] < model->heat[cold]) {
+					cold = i;
+				}
+			}
+			if (model->heat[hot] <= model->heat[cold]) {
+				break;
+			}
+			swap_frames(model, hot, cold);
+			model->tierprom[t]++;
+			model->tierdem[t + 1]++;
+		}
+	}
+	for (int i = 0; i < model->ppage; i++) {
+		model->heat[i] >>= 1;
+	}
+}
+
+// Move a newly loaded page into the fastest tier, demoting the coldest
+// page there into the frame the new page was loaded into.
+int place_fast(struct VM *model, int mem) {
+	int t = frame_tier(model, mem);
+	if (t == 0) {
+		return mem;
+	}
+	int cold = 0;
+	for (int i = 1; i < model->tierbase[1]; i++) {
+		if (model->heat[i] < model->heat[cold]) {
+			cold = i;
+		}
+	}
+	swap_frames(model, mem, cold);
+	model->tierprom[0]++;
+	model->tierdem[t]++;
+	return cold;
+}
+
+// Page pte became resident (delta 1) or left memory (delta -1): update
+// the resident page counts of the address spaces that map it.
+void count_resident(struct VM *model, int pte, int delta) {
+	if (model->amap == NULL || pte < 0) {
+		return;
+	}
+	for (int slot = model->rhead[pte]; slot != -1; slot = model->rnext[slot]) {
+		model->rss[slot / model->vpage] += delta;
+	}
+}
+
+// Make frame free. Its page is forgotten without being written back, so
+// the caller writes it back first if it is to be kept. The replacement
+// algorithm has already let go of the page.
+void free_frame(struct VM *model, int frame) {
+	for (int i = 0; i < model->tlb; i++) {
+		if (idx_get(model, model->ptlb, i) == frame && idx_get(model, model->vtlb, i) != -1) {
+			idx_set(model, model->vtlb, i, -1);
+		}
+	}
+	count_resident(model, idx_get(model, model->pvirt, frame), -1);
+	uncharge(model, frame);
+	idx_set(model, model->pvirt, frame, -1);
+	time_set(model, model->ptime, frame, model->tbase);
+	dirty_set(model, frame, 0);
+	if (model->ntier) {
+		model->heat[frame] = 0;
+	}
+	if (model->bypass == frame) {
+		model->bypass = -1;
+	}
+	idx_set(model, model->freeframes, model->nfreeframes++, frame);
+}
+
+void drop_frame(struct VM *model, int frame) {
+	page_drop(model, frame);
+	free_frame(model, frame);
+}
+
+int compare_pairs(const void *a, const void *b) {
+	const int *x = a, *y = b;
+	return x[0] != y[0] ? (x[0] > y[0]) - (x[0] < y[0]) : (x[1] > y[1]) - (x[1] < y[1]);
+}
+
+// The n least recently used pages that may be replaced, oldest first, as
+// n calls of oldest_frame would choose them but in one pass over the
+// frames.
+int *oldest_frames(struct VM *model, int n) {
+	int *pairs = INTS(2 * model->ppage), m = 0;
+	for (int i = next_unpinned(model, 0); i < model->ppage; i = next_unpinned(model, i + 1)) {
+		if (idx_get(model, model->pvirt, i) != -1) {
+			pairs[2 * m] = time_get(model, model->ptime, i);
+			pairs[2 * m + 1] = i;
+			m++;
+		}
+	}
+	qsort(pairs, m, 2 * sizeof(int), compare_pairs);
+	int *victims = INTS(n);
+	for (int i = 0; i < n && i < m; i++) {
+		victims[i] = pairs[2 * i + 1];
+	}
+	free(pairs);
+	return victims;
+}
+
+// Background reclaim: free frames are below the low watermark, so free
+// victims until they reach the high one. The victims are chosen first,
+// and the dirty ones are then written back in page order; runs of
+// consecutive pages count as one write-back. LRU victims are all found in
+// one pass; the other algorithms choose each victim in constant time or
+// by moving a clock hand on.
+void reclaim(struct VM *model) {
+	int n = model->wmhigh - model->nfreeframes;
+	int avail = model->ppage - model->npinned - model->nfreeframes;
+	if (n > avail) {
+		n = avail;
+	}
+	if (n <= 0) {
+		return;
+	}
+	int *out = INTS(2 * n), nout = 0;
+	int *victims = model->palg == VM_LRU_REPLACEMENT ? oldest_frames(model, n) : NULL;
+	for (int i = 0; i < n; i++) {
+		int frame = victims != NULL ? victims[i] : choose_page(model);
+		if (dirty_get(model, frame)) {
+			out[2 * nout] = idx_get(model, model->pvirt, frame);
+			out[2 * nout + 1] = frame;
+			nout++;
+		}
+		free_frame(model, frame);
+	}
+	free(victims);
+	qsort(out, nout, 2 * sizeof(int), compare_pairs);
+	for (int i = 0; i < nout; i++) {
+		disk_write(model, out[2 * i], make_address(model, out[2 * i + 1], 0));
+		model->wbruns += i == 0 || out[2 * i] != out[2 * i - 2] + 1;
+	}
+	model->dc += nout;
+	model->background += n;
+	model->batches++;
+	model->rfree += n;
+	free(out);
+}
+
+// The number of frames address space s may hold before it has to replace
+// its own pages, or 0 if it may take any frame.
+int frame_quota(struct VM *model, int s) {
+	if (model->olimit[s] > 0) {
+		return model->olimit[s];
+	} else if (model->scope == VM_SCOPE_LOCAL) {
+		return model->ppage / model->nspace > 0 ? model->ppage / model->nspace : 1;
+	}
+	return 0;
+}
+
+// Whether the current address space holds as many frames as it may, so
+// that its page faults replace its own pages.
+int at_quota(struct VM *model) {
+	if (model->fowner == NULL) {
+		return 0;
+	}
+	int quota = frame_quota(model, model->curspace);
+	return quota > 0 && model->ocount[model->curspace] >= quota;
+}
+
+// The address space whose frames the victim of an address space below
+// its quota has to come from, or -1 if it may come from any. Under local
+// replacement it is the address space furthest over its own quota.
+int victim_space(struct VM *model) {
+	if (model->fowner == NULL || model->scope != VM_SCOPE_LOCAL) {
+		return -1;
+	}
+	int space = -1, over = 0;
+	for (int i = 0; i < model->nspace; i++) {
+		if (model->ocount[i] - frame_quota(model, i) > over) {
+			over = model->ocount[i] - frame_quota(model, i);
+			space = i;
+		}
+	}
+	return space;
+}
+
+// Choose a victim among the unpinned frames charged to address space s
+// by walking its list, or return -1 if there is none. Round robin takes
+// the frame loaded first; the other algorithms take the least recently
+// used frame.
+int own_victim(struct VM *model, int s) {
+	int victim = -1, oldest = 0;
+	for (int f = model->ohead[s]; f != -1; f = model->fnext[f]) {
+		if (model->npinned && model->pinned[f]) {
+			continue;
+		}
+		int t = time_get(model, model->ptime, f);
+		if (victim == -1 || t < oldest) {
+			victim = f;
+			oldest = t;
+		}
+		if (model->palg == VM_ROUNDROBIN_REPLACEMENT) {
+			break;
+		}
+	}
+	if (victim != -1) {
+		page_drop(model, victim);
+	}
+	return victim;
+}
+
+// Choose the frame for a faulting page. With page admission filtering, a
+// page that has not been accessed more often than the victim is instead
+// loaded into the frame of the last page refused this way, so one-time
+// pages only displace each other. 2Q and LIRS filter such pages by
+// themselves and are left alone. A free frame is taken first.
+//
+// When replacement is scoped, the victim may have to be one of the frames
+// of a given address space; see setReplacementScope. An address space at
+// its quota replaces its own pages even if there are free frames.
+int choose_victim(struct VM *model, int pte) {
+	if (model->wmlow > 0 && model->nfreeframes < model->wmlow) {
+		reclaim(model);
+	}
+	int own = at_quota(model) ? own_victim(model, model->curspace) : -1;
+	if (own == -1 && model->nfreeframes > 0) {
+		if (model->rfree > 0) {
+			model->rfree--;
+			model->rfaults++;
+		} else {
+			model->coldfaults++;
+		}
+		return idx_get(model, model->freeframes, --model->nfreeframes);
+	}
+	model->direct++;
+	int space = own == -1 ? victim_space(model) : -1;
+	if (space != -1) {
+		own = own_victim(model, space);
+	}
+	if (own != -1) {
+		return own;
+	}
+	if (!model->admitpage || uses_nodes(model)) {
+		return choose_page(model);
+	}
+	int rrp = model->rrp, hand = model->wshand;
+	int victim = choose_page(model);
+	if (sketch_freq(model, pte) > sketch_freq(model, idx_get(model, model->pvirt, victim))) {
+		return victim;
+	}
+	model->rejpage++;
+	if (model->bypass != -1 && model->bypass != victim &&
+	    idx_get(model, model->pvirt, model->bypass) == model->bypasspage &&
+	    !(model->npinned && model->pinned[model->bypass])) {
+		model->rrp = rrp;
+		model->wshand = hand;
+		victim = model->bypass;
+	}
+	model->bypass = victim;
+	model->bypasspage = pte;
+	return victim;
+}
+
+// Make room for one more page number in every array indexed by page
+// number and return it.
+int new_page(struct VM *model) {
+	if (model->compact && model->npage >= VM_COMPACT_NONE) {
+		widen(model);
+	}
+	if (model->npage == model->pcap) {
+		int cap = model->pcap > 0 ? 2 * model->pcap : 64;
+		model->disk = realloc(model->disk, cap * sizeof(struct dpage *));
+		memset(model->disk + model->pcap, 0, (cap - model->pcap) * sizeof(struct dpage *));
+		if (uses_nodes(model)) {
+			model->vnode = resize(model, model->vnode, model->pcap * sizeof(int), cap * sizeof(int));
+			for (int i = model->pcap; i < cap; i++) {
+				model->vnode[i] = -1;
+			}
+		}
+		if (model->pshare != NULL) {
+			model->pshare = resize(model, model->pshare, model->pcap * sizeof(int), cap * sizeof(int));
+			model->rhead = resize(model, model->rhead, model->pcap * sizeof(int), cap * sizeof(int));
+			memset(model->pshare + model->pcap, 0, (cap - model->pcap) * sizeof(int));
+			memset(model->rhead + model->pcap, 0xff, (cap - model->pcap) * sizeof(int));
+		}
+		model->pcap = cap;
+	}
+	return model->npage++;
+}
+
+int hash_slot(struct VM *model, uint64_t key) {
+	int i = (int)((key * 0x9e3779b97f4a7c15ULL) >> 32) & (model->hsize - 1);
+	while (model->hkey[i] != 0 && model->hkey[i] != key) {
+		i = (i + 1) & (model->hsize - 1);
+	}
+	return i;
+}
+
+void grow_hash(struct VM *model) {
+	uint64_t *key = model->hkey;
+	int *val = model->hval, size = model->hsize;
+	model->hsize = size > 0 ? 2 * size : 1024;
+	model->hkey = (uint64_t *)calloc(model->hsize, sizeof(uint64_t));
+	model->hval = INTS(model->hsize);
+	for (int i = 0; i < size; i++) {
+		if (key[i] != 0) {
+			int j = hash_slot(model, key[i]);
+			model->hkey[j] = key[i];
+			model->hval[j] = val[i];
+		}
+	}
+	release(model, key);
+	release(model, val);
+}
+
+// Return the page number of a 64-bit virtual page, giving it one if it
+// has not been touched before.
+// The 64-bit entry points accept word addresses below 2^VM_ADDR64_BITS.
+#define VM_ADDR64_BITS 48
+
+int page_number(struct VM *model, uint64_t vpn) {
+	if (vpn < (uint64_t)model->vpage) {
+		return (int)vpn;
+	}
+	if (2 * (model->hcount + 1) > model->hsize) {
+		grow_hash(model);
+	}
+	uint64_t key = (vpn | (uint64_t)model->curspace << VM_ADDR64_BITS) + 1;
+	int i = hash_slot(model, key);
+	if (model->hkey[i] == 0) {
+		model->hkey[i] = key;
+		model->hval[i] = new_page(model);
+		model->hcount++;
+	}
+	return model->hval[i];
+}
+
+// Load page pte into a frame and return the frame. Its translation is
+// cached in the TLB if tlb is set.
+int fault_in(struct VM *model, int pte, int tlb) {
+	int mem = choose_victim(model, pte);
+	if (dirty_get(model, mem)) {
+		model->dc++;
+		disk_write(model, idx_get(model, model->pvirt, mem), make_address(model, mem, 0));
+	}
+	count_resident(model, idx_get(model, model->pvirt, mem), -1);
+	count_resident(model, pte, 1);
+	if (model->fowner != NULL) {
+		uncharge(model, mem);
+		charge(model, mem, model->curspace);
+	}
+	idx_set(model, model->pvirt, mem, pte);
+	time_set(model, model->ptime, mem, model->timestamp);
+	dirty_set(model, mem, 0);
+	page_fill(model, mem, pte);
+	disk_read(model, pte, make_address(model, mem, 0));
+	flushtlb(model, mem, pte, tlb);
+	if (model->ntier && model->tierplace == VM_TIER_PLACE_FAST) {
+		mem = place_fast(model, mem);
+	}
+	return mem;
+}
+
+// Write back the page in frame if it is dirty, and free the frame.
+void evict_frame(struct VM *model, int frame) {
+	if (dirty_get(model, frame)) {
+		model->dc++;
+		disk_write(model, idx_get(model, model->pvirt, frame), make_address(model, frame, 0));
+	}
+	drop_frame(model, frame);
+}
+
+// Empty physical memory and the TLB without writing anything back, with
+// frame 0 the first to be filled.
+void empty_frames(struct VM *model) {
+	for (int i = model->ppage - 1; i >= 0; i--) {
+		if (idx_get(model, model->pvirt, i) != -1) {
+			drop_frame(model, i);
+		}
+	}
+	for (int i = 0; i < model->ppage; i++) {
+		idx_set(model, model->freeframes, i, model->ppage - 1 - i);
+	}
+}
+
+// Load page pte ahead of its use, unless it is resident. Its translation
+// is left out of the TLB until the page is accessed.
+void prefetch(struct VM *model, int pte) {
+	if (lookup_in_mem(model, pte) == -1) {
+		fault_in(model, pte, 0);
+		model->prefetched++;
+	}
+}
+
+// The advice for virtual page vpn of the current address space.
+int page_advice(struct VM *model, int vpn) {
+	return model->advice != NULL ? model->advice[(size_t)model->curspace * model->vpage + vpn]
+	                             : VM_ADVISE_NORMAL;
+}
+
+// Pages of shared segments are marked in pshare by VM_SEGMENT_PAGE; they
+// are shared by every address space that maps them and never copied.
+#define VM_SEGMENT_PAGE (1 << 30)
+
+int cow_shared(struct VM *model, int pte) {
+	return model->pshare[pte] > 1 && !(model->pshare[pte] & VM_SEGMENT_PAGE);
+}
+
+// Make entry slot of amap, which maps no page, map page.
+void link_slot(struct VM *model, int slot, int page) {
+	model->rprev[slot] = -1;
+	model->rnext[slot] = model->rhead[page];
+	if (model->rhead[page] != -1) {
+		model->rprev[model->rhead[page]] = slot;
+	}
+	model->rhead[page] = slot;
+	model->pshare[page]++;
+	model->amap[slot] = page;
+}
+
+// The entry of virtual page vpn of the current address space in amap,
+// which is given a new page if it maps none yet.
+int *space_entry(struct VM *model, unsigned int vpn) {
+	if (vpn >= (unsigned int)model->vpage) {
+		fprintf(stderr, "page %u is out of range\n", vpn);
+		exit(1);
+	}
+	size_t slot = (size_t)model->curspace * model->vpage + vpn;
+	if (model->amap[slot] == -1) {
+		link_slot(model, slot, new_page(model));
+	}
+	return model->amap + slot;
+}
+
+// Make entry slot of amap map page instead of the page it maps now, if
+// any, which frame holds, or -1 if it is not resident. A page that no
+// address space or segment maps any more is discarded, and unlocked if it
+// was locked. A page that nothing maps yet, such as one just made by
+// new_page, is not resident.
+void map_slot(struct VM *model, int slot, int page, int frame) {
+	int old = model->amap[slot], space = slot / model->vpage;
+	if (old != -1) {
+		if (model->rprev[slot] != -1) {
+			model->rnext[model->rprev[slot]] = model->rnext[slot];
+		} else {
+			model->rhead[old] = model->rnext[slot];
+		}
+		if (model->rnext[slot] != -1) {
+			model->rprev[model->rnext[slot]] = model->rprev[slot];
+		}
+		model->pshare[old]--;
+		model->rss[space] -= frame != -1;
+	}
+	int resident = model->pshare[page] != 0 && lookup_in_mem(model, page) != -1;
+	link_slot(model, slot, page);
+	model->rss[space] += resident;
+	if (old != -1 && model->pshare[old] == 0) {
+		if (frame != -1 && model->npinned && model->pinned[frame]) {
+			// Locking took the page off the policy lists already.
+			model->pinned[frame] = 0;
+			model->npinned--;
+			link_pinned(model);
+			free_frame(model, frame);
+		} else if (frame != -1) {
+			drop_frame(model, frame);
+		}
+		disk_discard(model, old);
+	}
+}
+
+// Give the address space of entry a page of its own in place of the
+// shared page it maps, holding a copy of the shared page if copy is set
+// and zeros otherwise. A resident page is copied into a frame, a page on
+// disk on disk, where the copy shares the disk page until it is written.
+void cow_split(struct VM *model, int *entry, int copy) {
+	int old = *entry, page = new_page(model);
+	int frame = lookup_in_mem(model, old);
+	if (copy) {
+		if (frame != -1 && dirty_get(model, frame)) {
+			disk_write(model, page, make_address(model, frame, 0));
+		} else if (model->disk[old] != NULL) {
+			disk_used(model, page);
+			model->disk[page] = model->disk[old];
+			model->disk[page]->ref++;
+		}
+		model->cowcopies += frame != -1 || model->disk[old] != NULL;
+		model->cowfaults++;
+	}
+	map_slot(model, entry - model->amap, page, frame);
+	if (copy && frame != -1) {
+		fault_in(model, page, 1);
+	}
+}
+
+// The page that virtual page vpn of the current address space maps,
+// after giving it a page of its own if the access writes a shared page.
+int space_page(struct VM *model, unsigned int vpn, int write) {
+	if (model->amap == NULL) {
+		return vpn;
+	}
+	int *entry = space_entry(model, vpn);
+	if (write && cow_shared(model, *entry)) {
+		cow_split(model, entry, 1);
+	}
+	return *entry;
+}
+
+// The virtual page of the current address space that maps page pte, or
+// -1 if none does, as for the pages above the 32-bit address space.
+int page_vpn(struct VM *model, int pte) {
+	if (model->amap == NULL) {
+		return pte < model->vpage ? pte : -1;
+	}
+	for (int slot = model->rhead[pte]; slot != -1; slot = model->rnext[slot]) {
+		if (slot / model->vpage == model->curspace) {
+			return slot % model->vpage;
+		}
+	}
+	return -1;
+}
+
+// The page that virtual page vpn of the current address space maps, or
+// -1 if it has not been touched yet.
+int vpn_page(struct VM *model, int vpn) {
+	return model->amap != NULL ? model->amap[(size_t)model->curspace * model->vpage + vpn] : vpn;
+}
+
+// Page pte faulted: read the pages of the following virtual pages of the
+// current address space ahead. Pages advised to be sequential are read
+// further ahead, and those more than one window behind the fault have
+// been used and are evicted.
+void readahead(struct VM *model, int pte) {
+	int vpn = page_vpn(model, pte);
+	if (vpn == -1 || page_advice(model, vpn) == VM_ADVISE_RANDOM) {
+		return;
+	}
+	int n = model->readahead;
+	if (page_advice(model, vpn) == VM_ADVISE_SEQUENTIAL) {
+		n = 2 * n > VM_READAHEAD_SEQUENTIAL ? 2 * n : VM_READAHEAD_SEQUENTIAL;
+		for (int q = vpn - 2 * (n + 1); q < vpn - (n + 1); q++) {
+			int page = q >= 0 && page_advice(model, q) == VM_ADVISE_SEQUENTIAL ? vpn_page(model, q) : -1;
+			int frame = page != -1 ? lookup_in_mem(model, page) : -1;
+			if (frame != -1 && !(model->npinned && model->pinned[frame])) {
+				evict_frame(model, frame);
+				model->early++;
+			}
+		}
+	}
+	if (n > model->ppage / 2) {
+		n = model->ppage / 2;
+	}
+	for (int i = 1; i <= n && vpn + i < model->vpage; i++) {
+		prefetch(model, space_page(model, vpn + i, 0));
+	}
+}
+
+void *page_address(struct VM *model, int pte, int add, int dirty) {
+	advance(model, 1);
+	if (model->ntier && model->timestamp % model->epoch == 0) {
+		migrate_tiers(model);
+	}
+	if (model->palg == VM_WSCLOCK_REPLACEMENT && model->timestamp % model->tau == 0) {
+		sample_working_set(model);
+	}
+	if (model->sketch != NULL) {
+		sketch_record(model, pte);
+	}
+	int mem = lookup_in_tlb_and_mark(model, pte);
+	if (mem != -1) {
+		mark(model, mem, dirty);
+		page_hit(model, mem);
+		return make_address(model, mem, add);
+	}
+	model->tc++;
+	mem = lookup_in_mem(model, pte);
+	if (mem != -1) {
+		mark(model, mem, dirty);
+		page_hit(model, mem);
+		addtlb(model, mem, pte);
+		return make_address(model, mem, add);
+	}
+	model->pc++;
+	mem = fault_in(model, pte, 1);
+	// Reading ahead may displace the faulting page under a policy that
+	// keeps new pages in a short queue, such as LIRS; it is then loaded
+	// again.
+	if (model->readahead > 0 || model->advice != NULL) {
+		readahead(model, pte);
+		if (idx_get(model, model->pvirt, mem) != pte && (mem = lookup_in_mem(model, pte)) == -1) {
+			mem = fault_in(model, pte, 1);
+		}
+	}
+	mark(model, mem, dirty);
+	return make_address(model, mem, add);
+}
+
+void *real_address(struct VM *model, unsigned int address, int dirty) {
+	if (address / model->pagesize >= (unsigned int)model->vpage) {
+		fprintf(stderr, "address 0x%x is out of range\n", address);
+		exit(1);
+	}
+	return page_address(model, space_page(model, address / model->pagesize, dirty),
+	                    address % model->pagesize, dirty);
+}
+
+void *read_address(struct VM *model, unsigned int address) {
+	return real_address(model, address, 0);
+}
+
+void write_address(struct VM *model, unsigned int address, void *value) {
+	memcpy(real_address(model, address, 1), value, 4);
+}
+
+void *real_address64(struct VM *model, unsigned long long address, int dirty) {
+	if (address >> VM_ADDR64_BITS) {
+		fprintf(stderr, "address 0x%llx is out of range\n", address);
+		exit(1);
+	}
+	if (address < (unsigned long long)model->vpage * model->pagesize) {
+		return real_address(model, (unsigned int)address, dirty);
+	}
+	return page_address(model, page_number(model, address / model->pagesize),
+	                    address % model->pagesize, dirty);
+}
+
+// readInt
+//
+// Read an int from virtual memory.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+// If the address is out of range, an error message will be printed to
+// stderr and the program will be terminated.
+//
+int readInt(void *handle, unsigned int address) {
+	return *(int *)read_address(VM(handle), address);
+}
+
+// readFloat
+//
+// Read a float from virtual memory.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+// If the address is out of range, an error message will be printed to
+// stderr and the program will be terminated.
+//
+float readFloat(void *handle, unsigned int address) {
+	return *(float *)read_address(VM(handle), address);
+}
+
+// writeInt
+//
+// Write an int to virtual memory.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+// If the address is out of range, an error message will be printed to
+// stderr and the program will be terminated.
+//
+void writeInt(void *handle, unsigned int address, int value) {
+	write_address(VM(handle), address, &value);
+}
+
+// writeFloat
+//
+// Write a float to virtual memory.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+// If the address is out of range, an error message will be printed to
+// stderr and the program will be terminated.
+//
+void writeFloat(void *handle, unsigned int address, float value) {
+	write_address(VM(handle), address, &value);
+}
+
+// readInt64Addr, readFloat64Addr, writeInt64Addr, writeFloat64Addr
+//
+// Read or write an int or a float at a 64-bit virtual address. The 64-bit
+// address space holds 2^48 words; its first pages are the pages of the
+// 32-bit address space, so both families of functions see the same
+// memory there. Pages beyond the 32-bit address space are only given page
+// table entries and backing store when they are first touched, so a
+// sparse layout costs memory in proportion to the pages it uses.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+// If the address is out of range, an error message will be printed to
+// stderr and the program will be terminated.
+//
+int readInt64Addr(void *handle, unsigned long long address) {
+	return *(int *)real_address64(VM(handle), address, 0);
+}
+
+float readFloat64Addr(void *handle, unsigned long long address) {
+	return *(float *)real_address64(VM(handle), address, 0);
+}
+
+void writeInt64Addr(void *handle, unsigned long long address, int value) {
+	memcpy(real_address64(VM(handle), address, 1), &value, 4);
+}
+
+void writeFloat64Addr(void *handle, unsigned long long address, float value) {
+	memcpy(real_address64(VM(handle), address, 1), &value, 4);
+}
+
+// Heap allocator.
+//
+// vmMalloc carves objects out of the 32-bit virtual address space, from
+// page 1 upwards. Requests of up to half a page are rounded up to a power
+// of two words; objects of size class c (2^c words) are cut from slab
+// pages that hold only that class. Larger requests get a run of whole
+// pages. All allocator state lives in the simulation: heapclass records
+// for every page 0 (not heap), c + 1 (slab of class c) or minus the
+// length of the run starting there, heapfree[c] is a stack of the free
+// objects of class c, and heapruns lists free runs as start, length
+// pairs. The allocator itself never touches simulated memory, so only
+// the client's accesses to its objects are counted.
+//
+void heap_push(struct VM *model, int c, int address) {
+	if (model->heapn[c] == model->heapcap[c]) {
+		int cap = model->heapcap[c] > 0 ? 2 * model->heapcap[c] : 64;
+		model->heapfree[c] = resize(model, model->heapfree[c],
+		                            model->heapcap[c] * sizeof(int), cap * sizeof(int));
+		model->heapcap[c] = cap;
+	}
+	model->heapfree[c][model->heapn[c]++] = address;
+}
+
+// Take a run of n pages, first fit from the free runs, otherwise from the
+// top of the heap. Returns the first page or 0.
+int heap_pages(struct VM *model, int n) {
+	for (int i = 0; i < model->nruns; i++) {
+		int *run = model->heapruns + 2 * i;
+		if (run[1] >= n) {
+			int page = run[0];
+			run[0] += n;
+			run[1] -= n;
+			if (run[1] == 0) {
+				model->nruns--;
+				run[0] = model->heapruns[2 * model->nruns];
+				run[1] = model->heapruns[2 * model->nruns + 1];
+			}
+			return page;
+		}
+	}
+	if (model->heaptop + n > model->vpage) {
+		return 0;
+	}
+	model->heaptop += n;
+	return model->heaptop - n;
+}
+
+// Give back the run of n pages at page, merging it with free neighbours
+// and with the top of the heap.
+void heap_release(struct VM *model, int page, int n) {
+	for (int i = 0; i < model->nruns; i++) {
+		int *run = model->heapruns + 2 * i;
+		if (run[0] + run[1] == page || page + n == run[0]) {
+			page = run[0] < page ? run[0] : page;
+			n += run[1];
+			model->nruns--;
+			run[0] = model->heapruns[2 * model->nruns];
+			run[1] = model->heapruns[2 * model->nruns + 1];
+			i = -1;
+		}
+	}
+	if (page + n == model->heaptop) {
+		model->heaptop = page;
+		return;
+	}
+	if (model->nruns == model->runcap) {
+		int cap = model->runcap > 0 ? 2 * model->runcap : 16;
+		model->heapruns = resize(model, model->heapruns,
+		                         2 * model->runcap * sizeof(int), 2 * cap * sizeof(int));
+		model->runcap = cap;
+	}
+	model->heapruns[2 * model->nruns] = page;
+	model->heapruns[2 * model->nruns + 1] = n;
+	model->nruns++;
+}
+
+// vmMalloc
+//
+// Allocate an object of the given number of words in the virtual address
+// space and return its address, or 0 if the address space is exhausted.
+// Objects of up to half a page never straddle a page boundary, and
+// objects of the same size are packed together, so the allocation
+// pattern of a workload shows up in its page faults and TLB misses. The
+// contents of a new object are whatever the memory last held.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+unsigned int vmMalloc(void *handle, unsigned int words) {
+	struct VM *model = VM(handle);
+	if (model->heapclass == NULL) {
+		model->heapclass = INTS(model->vpage);
+		model->heaptop = 1;
+	}
+	if (words > (unsigned int)model->pagesize / 2) {
+		int n = (words - 1) / model->pagesize + 1;
+		int page = heap_pages(model, n);
+		if (page == 0) {
+			return 0;
+		}
+		model->heapclass[page] = -n;
+		model->heapobjs++;
+		model->heapwords += (long)n * model->pagesize;
+		return (unsigned int)page * model->pagesize;
+	}
+	int c = 0;
+	while ((1u << c) < words) {
+		c++;
+	}
+	if (model->heapn[c] == 0) {
+		int page = heap_pages(model, 1);
+		if (page == 0) {
+			return 0;
+		}
+		model->heapclass[page] = c + 1;
+		for (int i = model->pagesize - (1 << c); i >= 0; i -= 1 << c) {
+			heap_push(model, c, page * model->pagesize + i);
+		}
+	}
+	model->heapobjs++;
+	model->heapwords += 1 << c;
+	return model->heapfree[c][--model->heapn[c]];
+}
+
+// vmFree
+//
+// Free an object returned by vmMalloc. Its address is handed out again by
+// later allocations of the same size, most recently freed first.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined. Freeing an object twice has undefined behavior.
+//
+// If the address is not that of an object returned by vmMalloc, an error
+// message will be printed to stderr and the program will be terminated.
+//
+void vmFree(void *handle, unsigned int address) {
+	struct VM *model = VM(handle);
+	unsigned int page = address / model->pagesize;
+	int c = model->heapclass != NULL && page < (unsigned int)model->vpage ?
+	        model->heapclass[page] : 0;
+	if (c > 0 && address % (1u << (c - 1)) == 0) {
+		heap_push(model, c - 1, address);
+		model->heapobjs--;
+		model->heapwords -= 1 << (c - 1);
+	} else if (c < 0 && address % model->pagesize == 0) {
+		model->heapclass[page] = 0;
+		heap_release(model, page, -c);
+		model->heapobjs--;
+		model->heapwords -= (long)-c * model->pagesize;
+	} else {
+		fprintf(stderr, "address 0x%x was not allocated by vmMalloc\n", address);
+		exit(1);
+	}
+}
+
+// adviseVM
+//
+// Tell the simulation how the words from start to start + len - 1 of the
+// 32-bit address space will be used, for every page they touch:
+//   VM_ADVISE_NORMAL (0): no particular pattern; the default.
+//   VM_ADVISE_WILLNEED (1): the pages will be used soon and are loaded
+//     now.
+//   VM_ADVISE_DONTNEED (2): the contents are no longer needed. Resident
+//     pages are freed without being written back, and the pages read as
+//     zeros from then on. Locked pages are left alone.
+//   VM_ADVISE_SEQUENTIAL (3): the pages will be used in order. A fault
+//     reads at least VM_READAHEAD_SEQUENTIAL pages ahead, and pages more
+//     than one readahead window behind it are evicted.
+//   VM_ADVISE_RANDOM (4): no readahead.
+// The pages loaded ahead, freed and evicted early are reported by
+// printStatistics. Advice applies to the current address space, and
+// forkAddressSpace copies it to the new one.
+//
+// Returns 0 on success, or -1 if the hint is unknown.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int adviseVM(void *handle, unsigned int start, unsigned int len, int hint) {
+	struct VM *model = VM(handle);
+	if (hint < VM_ADVISE_NORMAL || hint > VM_ADVISE_RANDOM) {
+		return -1;
+	} else if (len == 0) {
+		return 0;
+	}
+	if (model->advice == NULL) {
+		model->advice = (unsigned char *)calloc((size_t)model->nspace * model->vpage, 1);
+	}
+	unsigned int first = start / model->pagesize;
+	unsigned int last = (start + len - 1) / model->pagesize;
+	for (unsigned int pte = first; pte <= last && pte < (unsigned int)model->vpage; pte++) {
+		int page = space_page(model, pte, 0);
+		if (hint == VM_ADVISE_WILLNEED) {
+			prefetch(model, page);
+		} else if (hint == VM_ADVISE_DONTNEED) {
+			int frame = lookup_in_mem(model, page);
+			if (frame != -1 && model->npinned && model->pinned[frame]) {
+				continue;
+			}
+			if (model->amap != NULL && model->pshare[page] & VM_SEGMENT_PAGE) {
+				continue;
+			} else if (model->amap != NULL && model->pshare[page] > 1) {
+				cow_split(model, space_entry(model, pte), 0);
+				continue;
+			}
+			if (frame != -1) {
+				drop_frame(model, frame);
+				model->dropped++;
+			}
+			disk_discard(model, page);
+		} else {
+			model->advice[(size_t)model->curspace * model->vpage + pte] = hint;
+		}
+	}
+	return 0;
+}
+
+// setReadahead
+//
+// Set the number of pages read ahead of a page fault. The default is 0.
+// Pages advised to be sequential are read twice as far ahead, and pages
+// advised to be random are never read ahead.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+void setReadahead(void *handle, unsigned int pages) {
+	VM(handle)->readahead = pages;
+}
+
+// lockPages
+//
+// Lock the pages touched by the words from start to start + len - 1 of
+// the 32-bit address space into physical memory. Pages that are not
+// resident are loaded, which counts as page faults, and from then on the
+// frames holding the pages are never chosen for replacement. If tlb is
+// nonzero the translations of the pages are cached in the TLB and not
+// replaced either, unless every entry of their set is locked. As with
+// mlock, a page shared copy-on-write with another address space is first
+// copied, as a write would, so that the lock holds only this address
+// space's page.
+//
+// Returns 0 on success, or -1 (locking nothing) if locking the range
+// would leave no frame for other pages.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int lockPages(void *handle, unsigned int start, unsigned int len, int tlb) {
+	struct VM *model = VM(handle);
+	if (len == 0) {
+		return 0;
+	}
+	unsigned int first = start / model->pagesize;
+	unsigned int last = (start + len - 1) / model->pagesize;
+	if (last >= (unsigned int)model->vpage) {
+		last = model->vpage - 1;
+	}
+	if (model->pinned == NULL) {
+		model->pinned = (unsigned char *)calloc(model->ppage, 1);
+		model->pinnext = INTS(model->ppage + 1);
+		link_pinned(model);
+	}
+	int n = model->npinned;
+	for (unsigned int vpn = first; vpn <= last; vpn++) {
+		int pte = space_page(model, vpn, 0);
+		int frame = lookup_in_mem(model, pte);
+		n += frame == -1 || !model->pinned[frame] || (model->amap != NULL && cow_shared(model, pte));
+	}
+	if (n >= model->ppage) {
+		return -1;
+	}
+	for (unsigned int vpn = first; vpn <= last; vpn++) {
+		int pte = space_page(model, vpn, 1);
+		int frame = lookup_in_mem(model, pte);
+		if (frame == -1) {
+			model->pc++;
+			frame = fault_in(model, pte, 1);
+		}
+		if (!model->pinned[frame]) {
+			page_drop(model, frame);
+			model->pinned[frame] = VM_PIN_FRAME;
+			model->pinnext[frame] = frame + 1;
+			model->npinned++;
+		}
+		if (tlb) {
+			model->pinned[frame] = VM_PIN_TLB;
+			if (lookup_in_tlb_and_mark(model, pte) == -1) {
+				addtlb(model, frame, pte);
+			}
+		}
+	}
+	return 0;
+}
+
+// unlockPages
+//
+// Unlock the pages touched by the words from start to start + len - 1 of
+// the 32-bit address space, so that they can be replaced again.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+void unlockPages(void *handle, unsigned int start, unsigned int len) {
+	struct VM *model = VM(handle);
+	unsigned int first = start / model->pagesize;
+	unsigned int last = (start + len - 1) / model->pagesize;
+	if (model->pinned == NULL || len == 0) {
+		return;
+	}
+	for (unsigned int vpn = first; vpn <= last && vpn < (unsigned int)model->vpage; vpn++) {
+		int pte = space_page(model, vpn, 0);
+		int frame = lookup_in_mem(model, pte);
+		if (frame != -1 && model->pinned[frame]) {
+			model->pinned[frame] = 0;
+			model->npinned--;
+			page_fill(model, frame, pte);
+		}
+	}
+	link_pinned(model);
+}
+
+// releasePages
+//
+// Give the frames holding the pages touched by the words from start to
+// start + len - 1 of the 32-bit address space back to the pool of free
+// frames, writing the pages back first if they are dirty. Page faults
+// take free frames before replacing any page. Locked pages are left
+// alone.
+//
+// Returns the number of frames released.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int releasePages(void *handle, unsigned int start, unsigned int len) {
+	struct VM *model = VM(handle);
+	unsigned int first = start / model->pagesize;
+	unsigned int last = (start + len - 1) / model->pagesize;
+	int n = 0;
+	for (unsigned int vpn = first; len > 0 && vpn <= last && vpn < (unsigned int)model->vpage; vpn++) {
+		int frame = lookup_in_mem(model, space_page(model, vpn, 0));
+		if (frame != -1 && !(model->npinned && model->pinned[frame])) {
+			evict_frame(model, frame);
+			n++;
+		}
+	}
+	model->released += n;
+	return n;
+}
+
+// setReclaimWatermarks
+//
+// Reclaim frames in batches, as a paging daemon would. When a page fault
+// finds fewer than low free frames, victims are freed until there are
+// high free frames, and their write-backs are issued together in page
+// order; the fault then takes a free frame. Faults that still have to
+// replace a page themselves are direct reclaims. printStatistics reports
+// both kinds, the number of batches, the number of runs of consecutive
+// pages written back and the faults served from reclaimed frames, which
+// are not counted as faults into free frames. A low watermark of 0 turns
+// batch reclaim off, which is the default.
+//
+// Returns 0 on success, or -1 if low is greater than high or high is not
+// less than the number of physical pages.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setReclaimWatermarks(void *handle, unsigned int low, unsigned int high) {
+	struct VM *model = VM(handle);
+	if (low > high || high >= (unsigned int)model->ppage) {
+		return -1;
+	}
+	model->wmlow = low;
+	model->wmhigh = high;
+	return 0;
+}
+
+// Set up address space 0 and the reverse map, if that has not been done.
+void init_spaces(struct VM *model) {
+	if (model->amap != NULL) {
+		return;
+	}
+	model->amap = INTS(model->vpage);
+	model->rnext = INTS(model->vpage);
+	model->rprev = INTS(model->vpage);
+	model->rss = INTS(1);
+	model->saccesses = (long *)calloc(1, sizeof(long));
+	model->sfaults = (long *)calloc(1, sizeof(long));
+	model->smisses = (long *)calloc(1, sizeof(long));
+	model->pshare = INTS(model->pcap);
+	model->rhead = INTS(model->pcap);
+	memset(model->rhead, 0xff, model->pcap * sizeof(int));
+	for (int i = 0; i < model->vpage; i++) {
+		model->amap[i] = model->rhead[i] = i;
+		model->rnext[i] = model->rprev[i] = -1;
+	}
+	for (int i = 0; i < model->npage; i++) {
+		model->pshare[i] = 1;
+	}
+	for (int i = 0; i < model->ppage; i++) {
+		int pte = idx_get(model, model->pvirt, i);
+		model->rss[0] += pte != -1 && pte < model->vpage;
+	}
+}
+
+// Add an address space whose entries of amap map no page yet and return
+// its number.
+int add_space(struct VM *model) {
+	size_t n = model->vpage, size = model->nspace * n * sizeof(int);
+	int i = model->nspace;
+	init_spaces(model);
+	model->amap = resize(model, model->amap, size, size + n * sizeof(int));
+	model->rnext = resize(model, model->rnext, size, size + n * sizeof(int));
+	model->rprev = resize(model, model->rprev, size, size + n * sizeof(int));
+	model->rss = resize(model, model->rss, i * sizeof(int), (i + 1) * sizeof(int));
+	model->saccesses = resize(model, model->saccesses, i * sizeof(long), (i + 1) * sizeof(long));
+	model->sfaults = resize(model, model->sfaults, i * sizeof(long), (i + 1) * sizeof(long));
+	model->smisses = resize(model, model->smisses, i * sizeof(long), (i + 1) * sizeof(long));
+	for (size_t v = 0; v < n; v++) {
+		model->amap[i * n + v] = -1;
+	}
+	if (model->advice != NULL) {
+		model->advice = resize(model, model->advice, i * n, (i + 1) * n);
+		memset(model->advice + i * n, VM_ADVISE_NORMAL, n);
+	}
+	model->rss[i] = 0;
+	model->saccesses[i] = model->sfaults[i] = model->smisses[i] = 0;
+	if (model->fowner != NULL) {
+		model->ohead = resize(model, model->ohead, i * sizeof(int), (i + 1) * sizeof(int));
+		model->otail = resize(model, model->otail, i * sizeof(int), (i + 1) * sizeof(int));
+		model->ocount = resize(model, model->ocount, i * sizeof(int), (i + 1) * sizeof(int));
+		model->olimit = resize(model, model->olimit, i * sizeof(int), (i + 1) * sizeof(int));
+		model->ohead[i] = model->otail[i] = -1;
+		model->ocount[i] = model->olimit[i] = 0;
+	}
+	return model->nspace++;
+}
+
+// forkAddressSpace
+//
+// Create an address space that is a copy of the current one, as fork
+// does, and return its number. The address space of createVM is number
+// 0. Nothing is copied yet: both address spaces map the pages of the
+// 32-bit address space, resident or on disk, copy-on-write, and a page
+// is copied the first time either of them writes it. Such a COW fault
+// copies a resident page into a frame of its own without counting a page
+// fault. Pages above the 32-bit address space are not shared; they start
+// as zeros in the new address space. printStatistics reports the COW
+// faults and the frames that hold a page for more than one address
+// space, which eager copying would have spent.
+//
+// The frames are saved, but the page tables are not: a fork takes time
+// and memory in proportion to the virtual address space, not to the
+// pages in use. The new address space gets a map entry and reverse-map
+// links for every virtual page, three ints each, and finding the
+// resident pages takes a pass over the frames and a byte per page.
+//
+// readInt, writeInt, adviseVM, lockPages and the functions like them
+// work on the current address space, which is chosen by
+// switchAddressSpace.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int forkAddressSpace(void *handle) {
+	struct VM *model = VM(handle);
+	size_t n = model->vpage;
+	int space = add_space(model);
+	if (model->advice != NULL) {
+		memcpy(model->advice + space * n, model->advice + model->curspace * n, n);
+	}
+	char *resident = (char *)calloc(model->npage, 1);
+	for (int i = 0; i < model->ppage; i++) {
+		int pte = idx_get(model, model->pvirt, i);
+		if (pte != -1) {
+			resident[pte] = 1;
+		}
+	}
+	for (size_t v = 0; v < n; v++) {
+		int page = model->amap[model->curspace * n + v];
+		if (page == -1) {
+			continue;
+		}
+		if (!(model->pshare[page] & VM_SEGMENT_PAGE)) {
+			model->cowshared += resident[page] || model->disk[page] != NULL;
+		}
+		link_slot(model, space * n + v, page);
+	}
+	free(resident);
+	model->rss[space] = model->rss[model->curspace];
+	return space;
+}
+
+// createAddressSpace
+//
+// Create an empty address space, whose pages all hold zeros, and return
+// its number. Each page is made when it is first touched, so an address
+// space that uses few of its pages costs little more than its map.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int createAddressSpace(void *handle) {
+	struct VM *model = VM(handle);
+	return add_space(model);
+}
+
+// switchAddressSpace
+//
+// Make address space asid, 0 or a number returned by forkAddressSpace
+// or createAddressSpace, the current one.
+//
+// Returns 0 on success, or -1 if there is no such address space.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int switchAddressSpace(void *handle, int asid) {
+	if (asid < 0 || asid >= VM(handle)->nspace) {
+		return -1;
+	}
+	VM(handle)->curspace = asid;
+	return 0;
+}
+
+// Start charging frames to address spaces, charging each resident page
+// to the first address space that mapped it, which is at the end of its
+// reverse map since link_slot adds slots at the head, or to address space
+// 0 if none maps it.
+void init_owners(struct VM *model) {
+	init_spaces(model);
+	if (model->fowner != NULL) {
+		return;
+	}
+	model->fowner = INTS(model->ppage);
+	model->fnext = INTS(model->ppage);
+	model->fprev = INTS(model->ppage);
+	model->ohead = INTS(model->nspace);
+	model->otail = INTS(model->nspace);
+	model->ocount = INTS(model->nspace);
+	model->olimit = INTS(model->nspace);
+	memset(model->fowner, 0xff, model->ppage * sizeof(int));
+	memset(model->ohead, 0xff, model->nspace * sizeof(int));
+	memset(model->otail, 0xff, model->nspace * sizeof(int));
+	for (int i = 0; i < model->ppage; i++) {
+		int pte = idx_get(model, model->pvirt, i);
+		if (pte != -1) {
+			int slot = model->rhead[pte];
+			while (slot != -1 && model->rnext[slot] != -1) {
+				slot = model->rnext[slot];
+			}
+			charge(model, i, slot != -1 ? slot / model->vpage : 0);
+		}
+	}
+}
+
+// setReplacementScope
+//
+// Choose where the victim of a page fault comes from when there are
+// several address spaces. Every frame is charged to the address space
+// whose access loaded its page.
+//   VM_SCOPE_GLOBAL (0): any frame, as the page replacement algorithm
+//     chooses; the default.
+//   VM_SCOPE_LOCAL (1): each address space has a quota of frames, its
+//     limit set by setMemoryLimit or else an equal share of physical
+//     memory. An address space at its quota replaces one of its own
+//     pages; one below it takes a frame from the address space furthest
+//     over its quota, or any frame if there is none.
+// Under either scope an address space at its memory limit replaces its
+// own pages. Those victims are found by walking the frames charged to the
+// address space: the first loaded under round robin, the least recently
+// used under the other algorithms. printStatistics reports the frames
+// charged to each address space and the fairness of the page fault rates
+// of the address spaces replayed by mixTraces, as Jain's index, which is
+// 1 when the rates are equal and 1/n when one address space has all the
+// faults.
+//
+// Returns 0 on success, or -1 if the scope is unknown.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setReplacementScope(void *handle, int scope) {
+	if (scope != VM_SCOPE_GLOBAL && scope != VM_SCOPE_LOCAL) {
+		return -1;
+	}
+	VM(handle)->scope = scope;
+	init_owners(VM(handle));
+	return 0;
+}
+
+// setMemoryLimit
+//
+// Limit address space asid to the given number of frames, like the memory
+// limit of a cgroup: once that many frames are charged to it, its page
+// faults replace its own pages. A limit of 0 removes the limit.
+//
+// Returns 0 on success, or -1 if there is no such address space or the
+// limit is larger than physical memory.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setMemoryLimit(void *handle, int asid, unsigned int frames) {
+	struct VM *model = VM(handle);
+	if (asid < 0 || asid >= model->nspace || frames > (unsigned int)model->ppage) {
+		return -1;
+	}
+	init_owners(model);
+	model->olimit[asid] = frames;
+	return 0;
+}
+
+// setFaultTime
+//
+// Make mixTraces keep time. An access takes one unit of time, and a page
+// fault blocks its process for time more units while other processes
+// run. Faults are served one at a time, as by a single paging disk, so a
+// fault also waits for the ones before it. When every process is blocked
+// the processor is idle. printStatistics reports the elapsed time and the
+// processor utilization, which is also the throughput in accesses per
+// unit of time: as more traces are mixed it rises while the processes
+// overlap their faults, and collapses once they thrash. A time of 0, the
+// default, turns this off, and processes then run their whole quantum.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+void setFaultTime(void *handle, unsigned int time) {
+	VM(handle)->faulttime = time;
+}
+
+// setLoadControl
+//
+// Control the load of mixTraces by page fault frequency. After every
+// window accesses of a process, its page fault rate over them is compared
+// with two thresholds in faults per 1000 accesses: above high its memory
+// limit (see setMemoryLimit) grows by a quarter, below low it shrinks by
+// an eighth, down to one frame. Limits not set start as an equal share of
+// physical memory. Whenever the limits of the running processes add up
+// to more than physical memory, the one with the largest limit is
+// suspended: its pages are swapped out, except those that running
+// processes share with it, and it is resumed when the others leave room
+// for its limit again. Suspended processes are resumed in the order they
+// were suspended, and the last running process is never suspended. A
+// process whose trace has ended swaps its pages out too.
+// Load control turns on local replacement; see setReplacementScope.
+// printStatistics reports the suspensions, the resumptions and the pages
+// swapped out. A window of 0, the default, turns load control off.
+//
+// Returns 0 on success, or -1 if low is greater than high.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setLoadControl(void *handle, unsigned int window, unsigned int low, unsigned int high) {
+	struct VM *model = VM(handle);
+	if (low > high) {
+		return -1;
+	}
+	model->pffwindow = window;
+	model->pfflow = low;
+	model->pffhigh = high;
+	if (window > 0) {
+		model->scope = VM_SCOPE_LOCAL;
+		init_owners(model);
+	}
+	return 0;
+}
+
+// createSegment
+//
+// Create a shared memory segment of the given number of pages, holding
+// zeros, and return its number. A segment is mapped into address spaces
+// by attachSegment; every address space that maps it reads and writes the
+// same pages, which are never copied on write, also not after
+// forkAddressSpace.
+//
+// A shared page is held by one frame and cached under one TLB entry for
+// all the address spaces that map it. Each page keeps a reverse map of
+// the address spaces mapping it, so the work of loading or evicting it
+// is in proportion to their number.
+//
+// Returns -1 if pages is 0.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int createSegment(void *handle, unsigned int pages) {
+	struct VM *model = VM(handle);
+	if (pages == 0) {
+		return -1;
+	}
+	init_spaces(model);
+	model->segbase = resize(model, model->segbase, model->nseg * sizeof(int),
+	                        (model->nseg + 1) * sizeof(int));
+	model->seglen = resize(model, model->seglen, model->nseg * sizeof(int),
+	                       (model->nseg + 1) * sizeof(int));
+	model->segbase[model->nseg] = model->npage;
+	model->seglen[model->nseg] = pages;
+	for (unsigned int i = 0; i < pages; i++) {
+		int page = new_page(model);
+		model->pshare[page] = VM_SEGMENT_PAGE;
+	}
+	return model->nseg++;
+}
+
+// attachSegment
+//
+// Map segment seg into the current address space at the pages from the
+// one holding word start on, in place of what they mapped before.
+//
+// Returns 0 on success, or -1 if there is no such segment or it does not
+// fit in the 32-bit address space there.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int attachSegment(void *handle, int seg, unsigned int start) {
+	struct VM *model = VM(handle);
+	unsigned int first = start / model->pagesize;
+	if (seg < 0 || seg >= model->nseg || first + model->seglen[seg] > (unsigned int)model->vpage) {
+		return -1;
+	}
+	int slot = model->curspace * model->vpage + first;
+	for (int i = 0; i < model->seglen[seg]; i++) {
+		if (model->amap[slot + i] != model->segbase[seg] + i) {
+			int page = model->amap[slot + i];
+			map_slot(model, slot + i, model->segbase[seg] + i,
+			         page != -1 ? lookup_in_mem(model, page) : -1);
+		}
+	}
+	return 0;
+}
+
+// detachSegment
+//
+// Unmap segment seg from the current address space. The pages that
+// mapped it hold zeros afterwards. The segment keeps its contents for the
+// address spaces that still map it or attach it later.
+//
+// Returns the number of pages unmapped, or -1 if there is no such
+// segment.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int detachSegment(void *handle, int seg) {
+	struct VM *model = VM(handle);
+	if (seg < 0 || seg >= model->nseg) {
+		return -1;
+	}
+	int n = 0;
+	for (int i = 0; i < model->seglen[seg]; i++) {
+		int slot = model->rhead[model->segbase[seg] + i];
+		int frame = slot != -1 ? lookup_in_mem(model, model->segbase[seg] + i) : -1;
+		while (slot != -1) {
+			int next = model->rnext[slot];
+			if (slot / model->vpage == model->curspace) {
+				map_slot(model, slot, new_page(model), frame);
+				n++;
+			}
+			slot = next;
+		}
+	}
+	return n;
+}
+
+// setMemoryTiers
+//
+// Divide physical memory into tiers of different speed, fastest first.
+// Tier i holds sizes[i] consecutive physical pages and each access to a
+// page in it costs latencies[i]. Every tier must hold at least one page,
+// and the sizes must add up to the size of the physical memory.
+//
+// Every epoch accesses, pages that were accessed more recently and more
+// often than pages in the tier above are promoted into it, and the pages
+// they displace are demoted. On a page fault the new page is placed in the
+// frame of the victim (VM_TIER_PLACE_VICTIM) or moved straight into the
+// fastest tier (VM_TIER_PLACE_FAST).
+//
+// Returns 0 on success, or -1 if the tiers violate the constraints above
+// or the placement is unknown.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setMemoryTiers(void *handle, int ntier, const unsigned int *sizes,
+                   const unsigned int *latencies, int placement, unsigned int epoch) {
+	struct VM *model = VM(handle);
+	long total = 0;
+	for (int i = 0; i < ntier; i++) {
+		if (sizes[i] == 0) {
+			return -1;
+		}
+		total += sizes[i];
+	}
+	if (ntier < 1 || total != model->ppage || epoch == 0 ||
+	    (placement != VM_TIER_PLACE_VICTIM && placement != VM_TIER_PLACE_FAST)) {
+		return -1;
+	}
+	release(model, model->tierbase);
+	release(model, model->tierlat);
+	release(model, model->heat);
+	release(model, model->tierhits);
+	release(model, model->tierprom);
+	release(model, model->tierdem);
+	model->ntier = ntier;
+	model->tierplace = placement;
+	model->epoch = epoch;
+	model->tierbase = INTS(ntier + 1);
+	model->tierlat = INTS(ntier);
+	model->heat = INTS(model->ppage);
+	model->tierhits = (long *)calloc(ntier, sizeof(long));
+	model->tierprom = (long *)calloc(ntier, sizeof(long));
+	model->tierdem = (long *)calloc(ntier, sizeof(long));
+	model->latency = 0;
+	for (int i = 0; i < ntier; i++) {
+		model->tierbase[i + 1] = model->tierbase[i] + sizes[i];
+		model->tierlat[i] = latencies[i];
+	}
+	return 0;
+}
+
+// setWorkingSetWindow
+//
+// Set the working set window tau used by WSClock replacement: a page that
+// has not been referenced in the last tau accesses is outside the working
+// set and may be replaced. The working set size is sampled every tau
+// accesses. The default window is the size of the physical memory.
+//
+// Returns 0 on success, or -1 if tau is 0.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setWorkingSetWindow(void *handle, unsigned int tau) {
+	if (tau == 0) {
+		return -1;
+	}
+	if (VM(handle)->compact && tau >= (unsigned int)time_window(VM(handle))) {
+		widen(VM(handle));
+	}
+	VM(handle)->tau = tau;
+	return 0;
+}
+
+// workingSetSize
+//
+// Return the number of resident pages referenced in the last tau
+// accesses.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int workingSetSize(void *handle) {
+	return working_set_size(VM(handle));
+}
+
+// setTLBAssociativity
+//
+// Make the TLB set associative with the given number of ways. The TLB is
+// divided into sizeTLB / ways sets and a virtual page can only be cached
+// in set (page mod number of sets). Replacement is done within a set.
+// Setting ways to sizeTLB makes the TLB fully associative again, which is
+// the default. The translations currently cached are kept where they fit
+// in their new set.
+//
+// Returns 0 on success, or -1 if ways does not divide the size of the TLB
+// or, with tree-PLRU replacement, is not a power of two.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setTLBAssociativity(void *handle, unsigned int ways) {
+	struct VM *model = VM(handle);
+	if (ways == 0 || model->tlb % ways != 0 ||
+	    (model->tlbalg == VM_TLB_TREE_PLRU_REPLACEMENT && (ways & (ways - 1)) != 0)) {
+		return -1;
+	}
+	int *ptlb = INTS(model->tlb), *vtlb = INTS(model->tlb), *tlbtime = INTS(model->tlb);
+	for (int i = 0; i < model->tlb; i++) {
+		ptlb[i] = idx_get(model, model->ptlb, i);
+		vtlb[i] = idx_get(model, model->vtlb, i);
+		tlbtime[i] = time_get(model, model->tlbtime, i);
+	}
+	release(model, model->tlbset);
+	model->tlbways = ways;
+	model->tlbsets = model->tlb / ways;
+	model->tlbset = INTS(model->tlbsets);
+	if (model->tlbbits != NULL) {
+		memset(model->tlbbits, 0, ALIGNUP(model->tlb, 64) / 8);
+	}
+	for (int i = 0; i < model->tlb; i++) {
+		idx_set(model, model->vtlb, i, -1);
+	}
+	for (int i = 0; i < model->tlb; i++) {
+		if (vtlb[i] == -1) {
+			continue;
+		}
+		int base = tlb_base(model, vtlb[i]);
+		for (int j = base; j < base + model->tlbways; j++) {
+			if (idx_get(model, model->vtlb, j) == -1) {
+				idx_set(model, model->vtlb, j, vtlb[i]);
+				idx_set(model, model->ptlb, j, ptlb[i]);
+				time_set(model, model->tlbtime, j, tlbtime[i]);
+				break;
+			}
+		}
+	}
+	free(ptlb);
+	free(vtlb);
+	free(tlbtime);
+	return 0;
+}
+
+// setAdmissionFilter
+//
+// Enable or disable frequency-based admission of pages into physical
+// memory (pages) and of translations into the TLB (tlb). When enabled,
+// the access frequency of every page is estimated, and a page fault or
+// TLB fill only displaces its victim if the incoming page was accessed
+// more often. A refused page is still loaded, but into the frame of the
+// previously refused page; a refused translation is not cached.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+void setAdmissionFilter(void *handle, int pages, int tlb) {
+	struct VM *model = VM(handle);
+	model->admitpage = pages;
+	model->admittlb = tlb;
+	if (!pages && !tlb) {
+		release(model, model->sketch);
+		model->sketch = NULL;
+		return;
+	}
+	if (model->sketch == NULL) {
+		int bits = 4;
+		while ((1 << bits) < 4 * model->ppage) {
+			bits++;
+		}
+		model->sketchbits = bits;
+		model->sketch = (unsigned char *)calloc(VM_SKETCH_ROWS << bits, 1);
+		model->sketchn = 0;
+		model->bypass = -1;
+	}
+}
+
+// The number of frames eager copying would have needed besides those
+// in use: a frame holding a page of k address spaces saves k - 1.
+int shared_frames(struct VM *model) {
+	int n = 0;
+	for (int i = 0; i < model->ppage; i++) {
+		int pte = idx_get(model, model->pvirt, i);
+		if (pte != -1 && cow_shared(model, pte)) {
+			n += model->pshare[pte] - 1;
+		}
+	}
+	return n;
+}
+
+// Jain's fairness index of the page fault rates of the address spaces
+// replayed by mixTraces, or -1 if there are none.
+double fairness(struct VM *model) {
+	double sum = 0, squares = 0;
+	int n = 0;
+	for (int i = 0; i < model->nspace; i++) {
+		if (model->saccesses[i] > 0) {
+			double rate = (double)model->sfaults[i] / model->saccesses[i];
+			sum += rate;
+			squares += rate * rate;
+			n++;
+		}
+	}
+	if (n == 0) {
+		return -1;
+	}
+	return squares > 0 ? sum * sum / (n * squares) : 1;
+}
+
+// printStatistics
+//
+// Print the total number of page faults, the total number of TLB misses
+// and the total number of disk writes.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+// Here is a sample output:
+//
+//   Number of page faults: 123
+//   Number of TLB misses: 125
+//   Number of disk writes: 64
+//
+// If memory tiers are in use, the accesses served by each tier, the pages
+// migrated into each tier and the total memory access time follow:
+//
+//   Tier 0: 9000 accesses, 40 promotions, 0 demotions
+//   Tier 1: 1000 accesses, 0 promotions, 40 demotions
+//   Memory access time: 19000
+//
+// With WSClock replacement the average and peak sampled working set size
+// follow:
+//
+//   Working set size: 12.5 average, 16 peak
+//
+// With an admission filter the number of refused pages and TLB fills
+// follow:
+//
+//   Admission refused: 812 pages, 2301 TLB fills
+//
+void printStatistics(void *handle) {
+	printf("Number of page faults: %d\n"
+		   "Number of TLB misses: %d\n"
+           "Number of disk writes: %d\n", 
+	       VM(handle)->pc, 
+	       VM(handle)->tc,
+	       VM(handle)->dc);
+	for (int i = 0; i < VM(handle)->ntier; i++) {
+		printf("Tier %d: %ld accesses, %ld promotions, %ld demotions\n", i,
+		       VM(handle)->tierhits[i], VM(handle)->tierprom[i], VM(handle)->tierdem[i]);
+	}
+	if (VM(handle)->ntier) {
+		printf("Memory access time: %ld\n", VM(handle)->latency);
+	}
+	if (VM(handle)->palg == VM_WSCLOCK_REPLACEMENT) {
+		printf("Working set size: %.1f average, %ld peak\n",
+		       VM(handle)->wsn ? (double)VM(handle)->wssum / VM(handle)->wsn : 0.0,
+		       VM(handle)->wsmax);
+	}
+	if (VM(handle)->sketch != NULL) {
+		printf("Admission refused: %ld pages, %ld TLB fills\n",
+		       VM(handle)->rejpage, VM(handle)->rejtlb);
+	}
+	if (VM(handle)->advice != NULL || VM(handle)->readahead > 0) {
+		printf("Pages read ahead: %ld, freed: %ld, evicted early: %ld\n",
+		       VM(handle)->prefetched, VM(handle)->dropped, VM(handle)->early);
+	}
+	if (VM(handle)->demand || VM(handle)->coldfaults || VM(handle)->released) {
+		printf("Free frames: %d, faults into free frames: %ld, frames released: %ld\n",
+		       VM(handle)->nfreeframes, VM(handle)->coldfaults, VM(handle)->released);
+	}
+	if (VM(handle)->wmlow > 0) {
+		printf("Reclaim: %ld direct, %ld background in %ld batches, %ld write-back runs, "
+		       "%ld faults into reclaimed frames\n", VM(handle)->direct, VM(handle)->background,
+		       VM(handle)->batches, VM(handle)->wbruns, VM(handle)->rfaults);
+	}
+	if (VM(handle)->pinned != NULL) {
+		printf("Locked frames: %d\n", VM(handle)->npinned);
+	}
+	if (VM(handle)->amap != NULL) {
+		printf("Copy-on-write: %d address spaces, %ld COW faults, %ld of %ld shared pages copied, "
+		       "%d frames saved\n", VM(handle)->nspace, VM(handle)->cowfaults,
+		       VM(handle)->cowcopies, VM(handle)->cowshared, shared_frames(VM(handle)));
+		for (int i = 0; i < VM(handle)->nspace; i++) {
+			printf("Address space %d: %d resident pages", i, VM(handle)->rss[i]);
+			if (VM(handle)->saccesses[i] > 0) {
+				printf(", %ld accesses, %ld page faults, %ld TLB misses", VM(handle)->saccesses[i],
+				       VM(handle)->sfaults[i], VM(handle)->smisses[i]);
+			}
+			if (VM(handle)->fowner != NULL) {
+				printf(", %d frames charged", VM(handle)->ocount[i]);
+			}
+			if (VM(handle)->fowner != NULL && VM(handle)->olimit[i] > 0) {
+				printf(" (limit %d)", VM(handle)->olimit[i]);
+			}
+			printf("\n");
+		}
+		if (VM(handle)->nspace > 1 && fairness(VM(handle)) >= 0) {
+			printf("Fairness: %.3f\n", fairness(VM(handle)));
+		}
+		if (VM(handle)->switches > 0) {
+			printf("Context switches: %ld\n", VM(handle)->switches);
+		}
+		if (VM(handle)->faulttime > 0 && VM(handle)->elapsed > 0) {
+			printf("Elapsed time: %ld, processor utilization: %.1f%%\n", VM(handle)->elapsed,
+			       100.0 * (VM(handle)->elapsed - VM(handle)->idle) / VM(handle)->elapsed);
+		}
+		if (VM(handle)->pffwindow > 0 || VM(handle)->suspensions > 0) {
+			printf("Load control: %ld suspensions, %ld resumptions, %ld pages swapped out\n",
+			       VM(handle)->suspensions, VM(handle)->resumptions, VM(handle)->swapped);
+		}
+	}
+	if (VM(handle)->nseg > 0) {
+		printf("Shared segments: %d\n", VM(handle)->nseg);
+	}
+	if (VM(handle)->heapclass != NULL) {
+		printf("Heap: %ld objects, %ld words, %d pages\n",
+		       VM(handle)->heapobjs, VM(handle)->heapwords, VM(handle)->heaptop - 1);
+	}
+}
+
+// Trace replay.
+//
+// A trace is a text file with one access per line: "r" or "w" followed by
+// a virtual address in decimal or 0x-prefixed hexadecimal, or a compact
+// trace written by encodeTrace. Traces ending in .gz or .zst are
+// decompressed by gzip or zstd in a child process.
+//
+// Replay is a pipeline: the decompressor runs in its own process, a
+// decoder thread parses its output into batches of accesses, and the
+// calling thread runs the batches through the simulation. Batches come
+// from a fixed pool and travel through two single-producer single-consumer
+// rings, full batches to the simulation and empty ones back, so the
+// pipeline runs in bounded memory and neither side takes a lock.
+//
+#define VM_TRACE_BATCH 4096
+#define VM_TRACE_QUEUE 16
+#define VM_TRACE_BLOCK 65536
+
+struct access {
+  unsigned int address;
+  int write, count;
+};
+
+struct batch {
+  int n;
+  struct access a[VM_TRACE_BATCH];
+};
+
+struct ring {
+  _Atomic size_t head, tail;
+  struct batch *slot[VM_TRACE_QUEUE];
+};
+
+struct trace {
+  struct VM *model;
+  const char *path;
+  FILE *in;
+  pid_t child;
+  pthread_t decoder;
+  int error, outside;
+  uint64_t address;
+  struct batch *cur;
+  struct ring full, empty;
+  struct batch *pool[VM_TRACE_QUEUE];
+};
+
+void ring_push(struct ring *r, struct batch *b) {
+	size_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	while (tail - atomic_load_explicit(&r->head, memory_order_acquire) == VM_TRACE_QUEUE) {
+		sched_yield();
+	}
+	r->slot[tail % VM_TRACE_QUEUE] = b;
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+struct batch *ring_pop(struct ring *r) {
+	size_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	while (atomic_load_explicit(&r->tail, memory_order_acquire) == head) {
+		sched_yield();
+	}
+	struct batch *b = r->slot[head % VM_TRACE_QUEUE];
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	return b;
+}
+
+int has_suffix(const char *s, const char *suffix) {
+	size_t n = strlen(s), m = strlen(suffix);
+	return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+// Open a trace for reading, starting a decompressor for compressed ones.
+FILE *open_trace(const char *path, pid_t *child) {
+	const char *tool = has_suffix(path, ".gz") ? "gzip" :
+	                   has_suffix(path, ".zst") ? "zstd" : NULL;
+	*child = -1;
+	if (tool == NULL) {
+		return fopen(path, "rb");
+	}
+	int fd[2];
+	if (access(path, R_OK) != 0 || pipe(fd) != 0) {
+		return NULL;
+	}
+	*child = fork();
+	if (*child == 0) {
+		dup2(fd[1], STDOUT_FILENO);
+		close(fd[0]);
+		close(fd[1]);
+		execlp(tool, tool, "-dc", path, (char *)NULL);
+		perror(tool);
+		_exit(127);
+	}
+	close(fd[1]);
+	if (*child < 0) {
+		close(fd[0]);
+		return NULL;
+	}
+	return fdopen(fd[0], "rb");
+}
+
+int close_trace(FILE *in, pid_t child) {
+	int status = 0;
+	fclose(in);
+	if (child > 0 && (waitpid(child, &status, 0) < 0 || status != 0)) {
+		return -1;
+	}
+	return 0;
+}
+
+// Parse one line of a text trace. Returns 1 for an access, 0 for a blank
+// line and -1 for a malformed line.
+int parse_line(char *line, unsigned long *address, int *write) {
+	while (*line == ' ' || *line == '\t' || *line == '\r') {
+		line++;
+	}
+	if (*line == '\n' || *line == 0) {
+		return 0;
+	}
+	if (*line != 'r' && *line != 'R' && *line != 'w' && *line != 'W') {
+		return -1;
+	}
+	*write = *line == 'w' || *line == 'W';
+	char *end;
+	*address = strtoul(line + 1, &end, 0);
+	return end == line + 1 ? -1 : 1;
+}
+
+// Add count accesses to the same page to the batch being decoded, handing
+// the batch to the simulation when it is full. Returns -1 if the address
+// is out of range, which is recorded in outside and address.
+int emit_run(struct trace *t, uint64_t address, int write, int count) {
+	if (address >= (uint64_t)t->model->vpage * t->model->pagesize) {
+		t->outside = 1;
+		t->address = address;
+		return -1;
+	}
+	struct batch *b = t->cur;
+	b->a[b->n].address = address;
+	b->a[b->n].write = write;
+	b->a[b->n].count = count;
+	if (++b->n == VM_TRACE_BATCH) {
+		ring_push(&t->full, b);
+		t->cur = ring_pop(&t->empty);
+		t->cur->n = 0;
+	}
+	return 0;
+}
+
+int emit(struct trace *t, uint64_t address, int write) {
+	return emit_run(t, address, write, 1);
+}
+
+// Decode a text trace whose first len bytes have already been read
+// into buf.
+void decode_text(struct trace *t, char *buf, size_t len) {
+	long line = 0;
+	int eof = 0;
+	while (!eof && !t->error) {
+		size_t got = fread(buf + len, 1, VM_TRACE_BLOCK, t->in);
+		eof = got < VM_TRACE_BLOCK;
+		len += got;
+		buf[len] = 0;
+		char *p = buf, *end = buf + len;
+		while (p < end) {
+			char *nl = memchr(p, '\n', end - p);
+			if (nl == NULL && !eof) {
+				break;
+			}
+			line++;
+			unsigned long address;
+			int write;
+			int k = parse_line(p, &address, &write);
+			if (k < 0) {
+				fprintf(stderr, "%s:%ld: malformed access\n", t->path, line);
+				t->error = 1;
+				break;
+			} else if (k > 0 && emit(t, address, write) != 0) {
+				fprintf(stderr, "%s:%ld: address 0x%lx is out of range\n", t->path, line, address);
+				t->error = 1;
+				break;
+			}
+			p = nl != NULL ? nl + 1 : end;
+		}
+		len = end - p;
+		memmove(buf, p, len);
+		if (len >= VM_TRACE_BLOCK) {
+			fprintf(stderr, "%s:%ld: line too long\n", t->path, line + 1);
+			t->error = 1;
+		}
+	}
+}
+
+// Compact traces.
+//
+// A compact trace starts with VM_TRACE_MAGIC and the log2 of the page size
+// it was encoded with, followed by one record per run of consecutive
+// accesses to the same page:
+//
+//   page delta    zigzag varint, from the page of the previous run
+//   header        varint: count << 3 | write << 2 | VM_RUN_SEQUENTIAL,
+//                         count << 3 | write << 2 | VM_RUN_REDUCED, or
+//                         count << 2 | VM_RUN_PACKED
+//   sequential:   varint first offset; the run reads or writes count
+//                 consecutive words
+//   reduced:      nothing; the run makes count accesses to the page, at
+//                 least one of them a write if write is set
+//   packed:       count fields of (offset << 1 | write), each log2(page
+//                 size) + 1 bits, packed low bit first and padded to a byte
+//
+#define VM_TRACE_MAGIC "SIMVMTR1"
+#define VM_TRACE_RUN 65536
+#define VM_RUN_PACKED 0
+#define VM_RUN_SEQUENTIAL 1
+#define VM_RUN_REDUCED 2
+
+int get_varint(FILE *in, uint64_t *v) {
+	int c, shift = 0;
+	*v = 0;
+	do {
+		if ((c = getc_unlocked(in)) == EOF || shift > 63) {
+			return -1;
+		}
+		*v |= (uint64_t)(c & 0x7f) << shift;
+		shift += 7;
+	} while (c & 0x80);
+	return 0;
+}
+
+void put_varint(FILE *out, uint64_t v) {
+	while (v >= 0x80) {
+		putc_unlocked((int)(v & 0x7f) | 0x80, out);
+		v >>= 7;
+	}
+	putc_unlocked((int)v, out);
+}
+
+int decode_run(struct trace *t, int bits, uint64_t page, uint64_t header) {
+	uint64_t base = page << bits;
+	if ((header & 3) == VM_RUN_REDUCED) {
+		if ((1 << bits) > t->model->pagesize || header >> 3 > INT32_MAX) {
+			return -1;
+		}
+		return emit_run(t, base, (header >> 2) & 1, header >> 3);
+	}
+	if ((header & 3) == VM_RUN_SEQUENTIAL) {
+		uint64_t offset;
+		if (get_varint(t->in, &offset) != 0) {
+			return -1;
+		}
+		for (uint64_t i = 0; i < header >> 3; i++) {
+			if (emit(t, base + offset + i, (header >> 2) & 1) != 0) {
+				return -1;
+			}
+		}
+		return 0;
+	}
+	uint64_t acc = 0;
+	int have = 0, width = bits + 1;
+	for (uint64_t i = 0; i < header >> 2; i++) {
+		while (have < width) {
+			int c = getc_unlocked(t->in);
+			if (c == EOF) {
+				return -1;
+			}
+			acc |= (uint64_t)c << have;
+			have += 8;
+		}
+		uint64_t field = acc & ((1ULL << width) - 1);
+		acc >>= width;
+		have -= width;
+		if (emit(t, base + (field >> 1), field & 1) != 0) {
+			return -1;
+		}
+	}
+	return 0;
+}
+
+void decode_compact(struct trace *t) {
+	uint64_t bits, delta, header, page = 0;
+	if (get_varint(t->in, &bits) != 0 || bits > 31) {
+		t->error = 1;
+	}
+	while (!t->error) {
+		int c = getc_unlocked(t->in);
+		if (c == EOF) {
+			break;
+		}
+		ungetc(c, t->in);
+		if (get_varint(t->in, &delta) != 0 || get_varint(t->in, &header) != 0) {
+			t->error = 1;
+			break;
+		}
+		page += (delta >> 1) ^ -(delta & 1);
+		t->error = decode_run(t, bits, page, header) != 0;
+	}
+	if (t->error && t->outside) {
+		fprintf(stderr, "%s: address 0x%llx is out of range\n", t->path, (unsigned long long)t->address);
+	} else if (t->error) {
+		fprintf(stderr, "%s: malformed compact trace\n", t->path);
+	}
+}
+
+void *decode_trace(void *arg) {
+	struct trace *t = arg;
+	char *buf = malloc(2 * VM_TRACE_BLOCK + 1);
+	size_t len = fread(buf, 1, strlen(VM_TRACE_MAGIC), t->in);
+	t->cur = ring_pop(&t->empty);
+	t->cur->n = 0;
+	if (len == strlen(VM_TRACE_MAGIC) && memcmp(buf, VM_TRACE_MAGIC, len) == 0) {
+		decode_compact(t);
+	} else {
+		decode_text(t, buf, len);
+	}
+	if (ferror(t->in)) {
+		perror(t->path);
+		t->error = 1;
+	}
+	if (t->cur->n > 0) {
+		ring_push(&t->full, t->cur);
+	}
+	ring_push(&t->full, NULL);
+	free(buf);
+	return NULL;
+}
+
+// Write one run of accesses to page of a compact trace.
+void encode_run(FILE *out, int bits, uint64_t page, uint64_t prev,
+                const unsigned int *offset, const char *write, int n, int reduce) {
+	int64_t delta = (int64_t)(page - prev);
+	put_varint(out, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+	if (reduce) {
+		int any = 0;
+		for (int i = 0; i < n; i++) {
+			any |= write[i];
+		}
+		put_varint(out, (uint64_t)n << 3 | any << 2 | VM_RUN_REDUCED);
+		return;
+	}
+	int sequential = 1;
+	for (int i = 1; i < n && sequential; i++) {
+		sequential = offset[i] == offset[0] + i && write[i] == write[0];
+	}
+	if (sequential) {
+		put_varint(out, (uint64_t)n << 3 | write[0] << 2 | VM_RUN_SEQUENTIAL);
+		put_varint(out, offset[0]);
+		return;
+	}
+	put_varint(out, (uint64_t)n << 2 | VM_RUN_PACKED);
+	uint64_t acc = 0;
+	int have = 0;
+	for (int i = 0; i < n; i++) {
+		acc |= ((uint64_t)offset[i] << 1 | write[i]) << have;
+		have += bits + 1;
+		while (have >= 8) {
+			putc_unlocked((int)(acc & 0xff), out);
+			acc >>= 8;
+			have -= 8;
+		}
+	}
+	if (have > 0) {
+		putc_unlocked((int)acc, out);
+	}
+}
+
+long encode_trace(const char *in, const char *out, unsigned int pageSize, int reduce);
+
+// encodeTrace
+//
+// Convert a text trace (which may be compressed, as for replayTrace) into
+// a compact trace that replayTrace reads directly. Consecutive accesses to
+// the same page of pageSize words are stored as one run; a run of
+// consecutive words with the same access type takes a few bytes, and any
+// other run takes log2(pageSize) + 1 bits per access. Encoding with the
+// page size of the simulated system gives the best compression.
+//
+// Returns the number of accesses encoded. If pageSize is not a power of
+// two, or either file cannot be read or written, or the input is
+// malformed, an error message is printed to stderr and -1 is returned.
+//
+long encodeTrace(const char *in, const char *out, unsigned int pageSize) {
+	return encode_trace(in, out, pageSize, 0);
+}
+
+// reduceTrace
+//
+// Like encodeTrace, but keep only the page, the number of accesses and
+// whether any of them was a write for each run of consecutive accesses to
+// the same page. Replaying a reduced trace on a system whose page size is
+// at least pageSize gives the same page faults, TLB misses and disk
+// writes as replaying the original trace, because the accesses after the
+// first in a run can only hit in the TLB.
+//
+// That does not hold for pages shared copy-on-write by forkAddressSpace.
+// A run that reads a shared page before it writes it is replayed as
+// writes from its first access, so the page is copied before it is ever
+// loaded: where the original trace loads the shared page and then copies
+// it, the reduced one faults the copy in from disk, and the page faults,
+// COW copies and frames used can differ. Use encodeTrace for traces that
+// are replayed after a fork.
+//
+// Returns the number of accesses in the trace, or -1 as for encodeTrace.
+//
+long reduceTrace(const char *in, const char *out, unsigned int pageSize) {
+	return encode_trace(in, out, pageSize, 1);
+}
+
+long encode_trace(const char *in, const char *out, unsigned int pageSize, int reduce) {
+	if (pageSize == 0 || (pageSize & (pageSize - 1)) != 0) {
+		fprintf(stderr, "encodeTrace: page size %u is not a power of two\n", pageSize);
+		return -1;
+	}
+	int bits = 0;
+	while ((1U << bits) < pageSize) {
+		bits++;
+	}
+	pid_t child;
+	FILE *src = open_trace(in, &child);
+	if (src == NULL) {
+		perror(in);
+		return -1;
+	}
+	FILE *dst = fopen(out, "wb");
+	if (dst == NULL) {
+		perror(out);
+		close_trace(src, child);
+		return -1;
+	}
+	fputs(VM_TRACE_MAGIC, dst);
+	put_varint(dst, bits);
+	unsigned int *offset = malloc(VM_TRACE_RUN * sizeof(unsigned int));
+	char *write = malloc(VM_TRACE_RUN);
+	char line[256];
+	uint64_t page = 0, prev = 0;
+	long count = 0, lineno = 0;
+	int n = 0, error = 0;
+	while (fgets(line, sizeof(line), src) != NULL) {
+		unsigned long address;
+		int w;
+		lineno++;
+		int k = parse_line(line, &address, &w);
+		if (k < 0) {
+			fprintf(stderr, "%s:%ld: malformed access\n", in, lineno);
+			error = 1;
+			break;
+		}
+		if (k == 0) {
+			continue;
+		}
+		if (n > 0 && (address >> bits != page || n == VM_TRACE_RUN)) {
+			encode_run(dst, bits, page, prev, offset, write, n, reduce);
+			prev = page;
+			n = 0;
+		}
+		page = address >> bits;
+		offset[n] = address & (pageSize - 1);
+		write[n++] = w;
+		count++;
+	}
+	if (n > 0) {
+		encode_run(dst, bits, page, prev, offset, write, n, reduce);
+	}
+	free(offset);
+	free(write);
+	if (close_trace(src, child) != 0 && !error) {
+		fprintf(stderr, "%s: decompression failed\n", in);
+		error = 1;
+	}
+	if (fclose(dst) != 0) {
+		perror(out);
+		error = 1;
+	}
+	return error ? -1 : count;
+}
+
+// Start the pipeline of the named trace. Returns NULL, after printing an
+// error message, if the trace cannot be opened or the decoder thread
+// cannot be started.
+struct trace *start_trace(struct VM *model, const char *path) {
+	struct trace *t = calloc(1, sizeof(struct trace));
+	t->model = model;
+	t->path = path;
+	t->in = open_trace(path, &t->child);
+	if (t->in == NULL) {
+		perror(path);
+		free(t);
+		return NULL;
+	}
+	for (int i = 0; i < VM_TRACE_QUEUE; i++) {
+		t->pool[i] = malloc(sizeof(struct batch));
+		ring_push(&t->empty, t->pool[i]);
+	}
+	int err = pthread_create(&t->decoder, NULL, decode_trace, t);
+	if (err != 0) {
+		fprintf(stderr, "%s: %s\n", path, strerror(err));
+		close_trace(t->in, t->child);
+		for (int i = 0; i < VM_TRACE_QUEUE; i++) {
+			free(t->pool[i]);
+		}
+		free(t);
+		return NULL;
+	}
+	return t;
+}
+
+// Wait for the pipeline of a trace whose batches have all been taken and
+// free it. Returns nonzero if the trace could not be read completely.
+int finish_trace(struct trace *t) {
+	pthread_join(t->decoder, NULL);
+	if (close_trace(t->in, t->child) != 0 && !t->error) {
+		fprintf(stderr, "%s: decompression failed\n", t->path);
+		t->error = 1;
+	}
+	int error = t->error;
+	for (int i = 0; i < VM_TRACE_QUEUE; i++) {
+		free(t->pool[i]);
+	}
+	free(t);
+	return error;
+}
+
+// Replay count accesses to the page of address. After the first access
+// the page is resident and cached in the TLB, so the rest are TLB hits
+// that only move the page's timestamps forward, unless a feature that
+// looks at every access is in use; then they are replayed one by one. So
+// are they under 2Q and LIRS with readahead, whose fills reorder the
+// policy lists that the hits after them would reorder again.
+void replay_run(struct VM *model, unsigned int address, int write, int count) {
+	void *p = real_address(model, address, write);
+	if (count == 1) {
+		return;
+	}
+	if (model->ntier || model->sketch != NULL ||
+	    model->palg == VM_WSCLOCK_REPLACEMENT ||
+	    (uses_nodes(model) && (model->readahead > 0 || model->advice != NULL))) {
+		for (int i = 1; i < count; i++) {
+			real_address(model, address, write);
+		}
+		return;
+	}
+	int frame = (int)(((char *)p - (char *)model->mem) / PAGEBYTES(model));
+	int pte = space_page(model, address / model->pagesize, 0);
+	advance(model, count - 1);
+	time_set(model, model->ptime, frame, model->timestamp);
+	lookup_in_tlb_and_mark(model, pte);
+}
+
+// replayTrace
+//
+// Run every access of the named trace through the virtual memory system.
+// Reads and writes are simulated for their effect on the statistics; the
+// memory contents are not changed.
+//
+// Returns the number of accesses replayed. If the trace cannot be read,
+// is malformed or contains an address that is out of range, an error
+// message is printed to stderr and -1 is returned; the accesses before
+// the error have been replayed.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+long replayTrace(void *handle, const char *path) {
+	struct trace *t = start_trace(VM(handle), path);
+	if (t == NULL) {
+		return -1;
+	}
+	long n = 0;
+	struct batch *b;
+	while ((b = ring_pop(&t->full)) != NULL) {
+		for (int i = 0; i < b->n; i++) {
+			replay_run(t->model, b->a[i].address, b->a[i].write, b->a[i].count);
+			n += b->a[i].count;
+		}
+		ring_push(&t->empty, b);
+	}
+	return finish_trace(t) ? -1 : n;
+}
+
+// Invalidate every entry of the TLB.
+void invalidate_tlb(struct VM *model) {
+	for (int i = 0; i < model->tlb; i++) {
+		idx_set(model, model->vtlb, i, -1);
+	}
+}
+
+// Whether the page in frame f is mapped by a process of mixTraces other
+// than s that is running, neither suspended nor finished. Process i runs
+// in address space i.
+int mapped_by_running(struct VM *model, int f, int s, struct trace **t, long *queued, int n) {
+	int pte = idx_get(model, model->pvirt, f);
+	for (int slot = model->rhead[pte]; slot != -1; slot = model->rnext[slot]) {
+		int i = slot / model->vpage;
+		if (i != s && i < n && t[i] != NULL && !queued[i]) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+// Write back and free the unpinned frames charged to address space s,
+// except those holding pages that other running processes still map, and
+// return how many there were.
+int swap_out(struct VM *model, int s, struct trace **t, long *queued, int n) {
+	int swapped = 0;
+	for (int f = model->ohead[s], next; f != -1; f = next) {
+		next = model->fnext[f];
+		if (!(model->npinned && model->pinned[f]) && !mapped_by_running(model, f, s, t, queued, n)) {
+			evict_frame(model, f);
+			swapped++;
+		}
+	}
+	return swapped;
+}
+
+// Page fault frequency: once address space s has made pffwindow accesses
+// since its limit was last adjusted, grow or shrink the limit by its
+// fault rate over them. mark holds the accesses and faults of each
+// address space at the last adjustment.
+void adjust_limit(struct VM *model, int s, long *mark) {
+	long accesses = model->saccesses[s] - mark[2 * s];
+	if (accesses < model->pffwindow) {
+		return;
+	}
+	long faults = model->sfaults[s] - mark[2 * s + 1];
+	int limit = frame_quota(model, s);
+	if (faults * 1000 > model->pffhigh * accesses) {
+		limit += limit / 4 + 1;
+	} else if (faults * 1000 < model->pfflow * accesses) {
+		limit -= limit / 8 + 1;
+	}
+	model->olimit[s] = limit < 1 ? 1 : limit > model->ppage ? model->ppage : limit;
+	mark[2 * s] = model->saccesses[s];
+	mark[2 * s + 1] = model->sfaults[s];
+}
+
+// Load control for the n processes of mixTraces. A process is running
+// while its trace t[i] has accesses left, and suspended while queued[i]
+// holds its place in line, counted by seq. Suspend the running processes
+// with the largest limits until the limits of the rest fit in physical
+// memory, then resume suspended ones in order while theirs fit too.
+void load_control(struct VM *model, struct trace **t, long *queued, int n, long *seq) {
+	long demand = 0;
+	int active = 0;
+	for (int i = 0; i < n; i++) {
+		if (t[i] != NULL && !queued[i]) {
+			demand += frame_quota(model, i);
+			active++;
+		}
+	}
+	while (demand > model->ppage && active > 1) {
+		int victim = -1;
+		for (int i = 0; i < n; i++) {
+			if (t[i] != NULL && !queued[i] &&
+			    (victim == -1 || frame_quota(model, i) > frame_quota(model, victim))) {
+				victim = i;
+			}
+		}
+		demand -= frame_quota(model, victim);
+		active--;
+		queued[victim] = ++*seq;
+		model->swapped += swap_out(model, victim, t, queued, n);
+		model->suspensions++;
+	}
+	for (;;) {
+		int next = -1;
+		for (int i = 0; i < n; i++) {
+			if (t[i] != NULL && queued[i] && (next == -1 || queued[i] < queued[next])) {
+				next = i;
+			}
+		}
+		if (next == -1 || (active > 0 && demand + frame_quota(model, next) > model->ppage)) {
+			break;
+		}
+		demand += frame_quota(model, next);
+		active++;
+		queued[next] = 0;
+		model->resumptions++;
+	}
+}
+
+// The process to run after process prev in mixTraces: the next one in
+// round-robin order that is running and not blocked by a page fault until
+// ready[i]. If all of them are blocked, the processor is idle until the
+// first one is ready.
+int next_process(struct VM *model, struct trace **t, long *queued, long *ready, int n, int prev) {
+	for (;;) {
+		long first = -1;
+		for (int k = 1; k <= n; k++) {
+			int i = (prev + k) % n;
+			if (t[i] == NULL || queued[i]) {
+				continue;
+			} else if (ready[i] <= model->elapsed) {
+				return i;
+			} else if (first == -1 || ready[i] < first) {
+				first = ready[i];
+			}
+		}
+		model->idle += first - model->elapsed;
+		model->elapsed = first;
+	}
+}
+
+// mixTraces
+//
+// Replay n traces concurrently, as processes run by a round-robin
+// scheduler: trace i runs in address space i, and each process runs for
+// quantum accesses before the next one that has accesses left takes over.
+// Address spaces that do not exist yet are created empty. If flush is
+// nonzero the TLB is flushed on every context switch, as on a machine
+// without address space identifiers; otherwise entries are kept across
+// switches, as address space identifiers allow. With setFaultTime a
+// process that faults gives up the processor until its page arrives, and
+// with setLoadControl processes may be suspended while memory is short.
+// The current address space is unchanged afterwards.
+//
+// printStatistics reports the number of context switches and, for each
+// address space, the accesses replayed and the page faults and TLB misses
+// they caused. Mixing more and more traces shows the multiprogramming
+// level at which the page fault rate climbs.
+//
+// Returns the number of accesses replayed, or -1 if n or quantum is 0 or
+// a trace cannot be read, is malformed or contains an address that is out
+// of range; an error message is printed to stderr for the trace, and the
+// others are still replayed to the end.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+long mixTraces(void *handle, const char **paths, int n, unsigned int quantum, int flush) {
+	struct VM *model = VM(handle);
+	if (n <= 0 || quantum == 0) {
+		return -1;
+	}
+	init_spaces(model);
+	while (model->nspace < n) {
+		createAddressSpace(handle);
+	}
+	struct trace **t = calloc(n, sizeof(struct trace *));
+	struct batch **b = calloc(n, sizeof(struct batch *));
+	int *pos = INTS(n), *left = INTS(n);
+	long *queued = (long *)calloc(n, sizeof(long)), *ready = (long *)calloc(n, sizeof(long));
+	long *mark = (long *)calloc(2 * n, sizeof(long));
+	int running = 0, error = 0, prev = -1, current = model->curspace;
+	for (int i = 0; i < n; i++) {
+		t[i] = start_trace(model, paths[i]);
+		running += t[i] != NULL;
+		error |= t[i] == NULL;
+		mark[2 * i] = model->saccesses[i];
+		mark[2 * i + 1] = model->sfaults[i];
+	}
+	long total = 0, seq = 0, disk = model->elapsed;
+	if (model->pffwindow > 0) {
+		load_control(model, t, queued, n, &seq);
+	}
+	while (running > 0) {
+		int i = next_process(model, t, queued, ready, n, prev);
+		if (prev != i && prev != -1) {
+			model->switches++;
+			if (flush) {
+				invalidate_tlb(model);
+			}
+		}
+		prev = i;
+		model->curspace = i;
+		int pc = model->pc, tc = model->tc;
+		long done = 0;
+		while (done < quantum) {
+			if (b[i] != NULL && pos[i] == b[i]->n) {
+				ring_push(&t[i]->empty, b[i]);
+				b[i] = NULL;
+			}
+			if (b[i] == NULL) {
+				b[i] = ring_pop(&t[i]->full);
+				pos[i] = 0;
+				if (b[i] == NULL) {
+					error |= finish_trace(t[i]);
+					t[i] = NULL;
+					running--;
+					break;
+				}
+				left[i] = b[i]->a[0].count;
+			}
+			struct access *a = &b[i]->a[pos[i]];
+			int k = left[i] < quantum - done ? left[i] : (int)(quantum - done);
+			int faults = model->pc;
+			if (model->faulttime > 0 && k > 1) {
+				replay_run(model, a->address, a->write, 1);
+				if (model->pc == faults) {
+					replay_run(model, a->address, a->write, k - 1);
+				} else {
+					k = 1;
+				}
+			} else {
+				replay_run(model, a->address, a->write, k);
+			}
+			done += k;
+			if ((left[i] -= k) == 0 && ++pos[i] < b[i]->n) {
+				left[i] = b[i]->a[pos[i]].count;
+			}
+			if (model->faulttime > 0 && model->pc != faults) {
+				long now = model->elapsed + done;
+				disk = (disk > now ? disk : now) + (long)(model->pc - faults) * model->faulttime;
+				ready[i] = disk;
+				break;
+			}
+		}
+		model->saccesses[i] += done;
+		model->sfaults[i] += model->pc - pc;
+		model->smisses[i] += model->tc - tc;
+		model->elapsed += done;
+		total += done;
+		if (model->pffwindow > 0) {
+			if (t[i] == NULL) {
+				swap_out(model, i, t, queued, n);
+			} else {
+				adjust_limit(model, i, mark);
+			}
+			load_control(model, t, queued, n, &seq);
+		}
+	}
+	model->curspace = current;
+	free(t);
+	free(b);
+	free(pos);
+	free(left);
+	free(queued);
+	free(ready);
+	free(mark);
+	return error ? -1 : total;
+}
+
+// Metadata blocks.
+//
+// Every array hanging off struct VM other than physical memory and the
+// disk image is listed by meta_blocks, so that cloning, checkpointing and
+// cleanup handle new state without further changes. Arrays of optional
+// features are listed with length 0 when the feature is not in use.
+//
+#define VM_MAX_BLOCKS 96
+
+struct meta {
+  void **ptr;
+  size_t len;
+};
+
+#define RAWBLOCK(field, bytes) \
+	(m[k++] = (struct meta){ (void **)&model->field, (bytes) })
+#define BLOCK(field, n) RAWBLOCK(field, (size_t)(n) * sizeof(*model->field))
+#define SMALL(n) ((size_t)(n) * (model->compact ? sizeof(uint16_t) : sizeof(int)))
+
+int meta_blocks(struct VM *model, struct meta *m) {
+	int k = 0;
+	RAWBLOCK(pvirt, SMALL(model->ppage));
+	RAWBLOCK(ptime, SMALL(model->ppage));
+	RAWBLOCK(dirty, model->compact ? (size_t)ALIGNUP(model->ppage, 64) / 8 : model->ppage * sizeof(int));
+	RAWBLOCK(ptlb, SMALL(model->tlb));
+	RAWBLOCK(vtlb, SMALL(model->tlb));
+	RAWBLOCK(tlbtime, SMALL(model->tlb));
+	RAWBLOCK(freeframes, SMALL(model->ppage));
+	BLOCK(tlbset, model->tlbsets);
+	BLOCK(tlbbits, uses_tlbbits(model) ? ALIGNUP(model->tlb, 64) / 64 : 0);
+	BLOCK(hkey, model->hsize);
+	BLOCK(hval, model->hsize);
+	BLOCK(tierbase, model->ntier ? model->ntier + 1 : 0);
+	BLOCK(tierlat, model->ntier);
+	BLOCK(heat, model->ntier ? model->ppage : 0);
+	BLOCK(tierhits, model->ntier);
+	BLOCK(tierprom, model->ntier);
+	BLOCK(tierdem, model->ntier);
+	BLOCK(nodes, uses_nodes(model) ? 2 * model->ppage + 2 : 0);
+	BLOCK(vnode, uses_nodes(model) ? model->pcap : 0);
+	BLOCK(sketch, model->sketch != NULL ? VM_SKETCH_ROWS << model->sketchbits : 0);
+	BLOCK(heapclass, model->heapclass != NULL ? model->vpage : 0);
+	for (int c = 0; c < VM_HEAP_CLASSES; c++) {
+		BLOCK(heapfree[c], model->heapcap[c]);
+	}
+	BLOCK(heapruns, 2 * model->runcap);
+	BLOCK(advice, model->advice != NULL ? (size_t)model->nspace * model->vpage : 0);
+	BLOCK(pinned, model->pinned != NULL ? model->ppage : 0);
+	BLOCK(pinnext, model->pinned != NULL ? model->ppage + 1 : 0);
+	BLOCK(amap, model->amap != NULL ? (size_t)model->nspace * model->vpage : 0);
+	BLOCK(pshare, model->amap != NULL ? model->pcap : 0);
+	BLOCK(rhead, model->amap != NULL ? model->pcap : 0);
+	BLOCK(rnext, model->amap != NULL ? (size_t)model->nspace * model->vpage : 0);
+	BLOCK(rprev, model->amap != NULL ? (size_t)model->nspace * model->vpage : 0);
+	BLOCK(rss, model->amap != NULL ? model->nspace : 0);
+	BLOCK(saccesses, model->amap != NULL ? model->nspace : 0);
+	BLOCK(sfaults, model->amap != NULL ? model->nspace : 0);
+	BLOCK(smisses, model->amap != NULL ? model->nspace : 0);
+	BLOCK(fowner, model->fowner != NULL ? model->ppage : 0);
+	BLOCK(fnext, model->fowner != NULL ? model->ppage : 0);
+	BLOCK(fprev, model->fowner != NULL ? model->ppage : 0);
+	BLOCK(ohead, model->fowner != NULL ? model->nspace : 0);
+	BLOCK(otail, model->fowner != NULL ? model->nspace : 0);
+	BLOCK(ocount, model->fowner != NULL ? model->nspace : 0);
+	BLOCK(olimit, model->fowner != NULL ? model->nspace : 0);
+	BLOCK(segbase, model->nseg);
+	BLOCK(seglen, model->nseg);
+	return k;
+}
+
+// Map size bytes of zeroed memory aligned to align, with huge pages if
+// hostpages asks for them and the host has them. Sets hostpages to the
+// kind of pages actually used.
+char *map_region(size_t size, size_t align, int *hostpages) {
+	if (*hostpages == VM_HOST_PAGES_EXPLICIT) {
+		char *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		               MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (p != MAP_FAILED) {
+			return p;
+		}
+		*hostpages = VM_HOST_PAGES_TRANSPARENT;
+	}
+	char *p = mmap(NULL, size + align - VM_HOST_PAGE, PROT_READ | PROT_WRITE,
+	               MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED) {
+		perror("simVM");
+		exit(-1);
+	}
+	size_t head = ALIGNUP((uintptr_t)p, align) - (uintptr_t)p;
+	if (head > 0) {
+		munmap(p, head);
+	}
+	if (align - VM_HOST_PAGE - head > 0) {
+		munmap(p + head + size, align - VM_HOST_PAGE - head);
+	}
+	p += head;
+	if (*hostpages == VM_HOST_PAGES_TRANSPARENT && madvise(p, size, MADV_HUGEPAGE) != 0) {
+		*hostpages = VM_HOST_PAGES_NORMAL;
+	}
+	return p;
+}
+
+// Allocate the arena of model and point physical memory and every
+// metadata block at it. Each block starts on a cache line and physical
+// memory on a host page, or on a huge page if huge pages are used. The
+// arena is zeroed; the previous contents of the blocks are not copied.
+void map_arena(struct VM *model) {
+	struct meta m[VM_MAX_BLOCKS];
+	int n = meta_blocks(model, m);
+	size_t size = 0;
+	for (int i = 0; i < n; i++) {
+		size += ALIGNUP(m[i].len, VM_CACHE_LINE);
+	}
+	size_t align = model->hostpages != VM_HOST_PAGES_NORMAL ? VM_HOST_HUGE_PAGE : VM_HOST_PAGE;
+	size_t memoff = ALIGNUP(size, align);
+	size = ALIGNUP(memoff + model->ppage * PAGEBYTES(model), align);
+	char *arena = map_region(size, align, &model->hostpages);
+	size_t off = 0;
+	for (int i = 0; i < n; i++) {
+		*m[i].ptr = m[i].len ? arena + off : NULL;
+		off += ALIGNUP(m[i].len, VM_CACHE_LINE);
+	}
+	model->mem = arena + memoff;
+	model->arena = arena;
+	model->arenasize = size;
+}
+
+// Move model to a new arena holding the same contents. The previous
+// blocks are left for the caller to release.
+void copy_arena(struct VM *model) {
+	struct meta m[VM_MAX_BLOCKS];
+	int n = meta_blocks(model, m);
+	void *old[VM_MAX_BLOCKS];
+	for (int i = 0; i < n; i++) {
+		old[i] = *m[i].ptr;
+	}
+	void *mem = model->mem;
+	map_arena(model);
+	for (int i = 0; i < n; i++) {
+		if (m[i].len) {
+			memcpy(*m[i].ptr, old[i], m[i].len);
+		}
+	}
+	memcpy(model->mem, mem, model->ppage * PAGEBYTES(model));
+}
+
+// Checkpoint file layout.
+//
+// A checkpoint is a header holding struct VM itself, followed by the
+// metadata blocks, a bitset of the pages that have a disk copy, then
+// physical memory and the disk image. Physical memory and disk start on a
+// page boundary of the file so that a loader may map them directly. Disk
+// pages without a copy are holes in the file, and the bitset lets a
+// loader skip them without reading them. The version must be bumped
+// whenever struct VM or the layout changes.
+//
+#define VM_IMAGE_MAGIC "SIMVMCKP"
+#define VM_IMAGE_VERSION 24
+#define VM_IMAGE_ALIGN 4096
+
+struct vm_image {
+  char magic[8];
+  int version, size;
+  struct VM model;
+};
+
+size_t image_meta_size(struct VM *model) {
+	struct meta m[VM_MAX_BLOCKS];
+	size_t size = sizeof(struct vm_image) + ALIGNUP((size_t)model->npage, 8) / 8;
+	for (int i = meta_blocks(model, m) - 1; i >= 0; i--) {
+		size += m[i].len;
+	}
+	return size;
+}
+
+int write_block(FILE *f, const void *p, size_t n) {
+	return n == 0 || fwrite(p, 1, n, f) == n ? 0 : -1;
+}
+
+int pad_to(FILE *f, size_t off) {
+	static const char zeros[VM_IMAGE_ALIGN];
+	long pos = ftell(f);
+	if (pos < 0) {
+		return -1;
+	}
+	return write_block(f, zeros, off - pos);
+}
+
+// saveVM
+//
+// Save the complete state of the virtual memory system (configuration,
+// page table, TLB, replacement state, statistics, physical memory and
+// disk contents) to the named file.
+//
+// Returns 0 on success. If the file cannot be written, an error message
+// is printed to stderr and -1 is returned.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int saveVM(void *handle, const char *path) {
+	struct VM *model = VM(handle);
+	struct vm_image h = { .version = VM_IMAGE_VERSION, .size = sizeof(struct VM), .model = *model };
+	memcpy(h.magic, VM_IMAGE_MAGIC, sizeof(h.magic));
+	struct meta m[VM_MAX_BLOCKS];
+	int n = meta_blocks(model, m);
+	size_t memoff = ALIGNUP(image_meta_size(model), VM_IMAGE_ALIGN);
+	size_t memsize = model->ppage * PAGEBYTES(model);
+	FILE *f = fopen(path, "wb");
+	if (f == NULL) {
+		perror(path);
+		return -1;
+	}
+	int err = write_block(f, &h, sizeof(h));
+	for (int i = 0; i < n && !err; i++) {
+		err = write_block(f, *m[i].ptr, m[i].len);
+	}
+	size_t nbits = ALIGNUP((size_t)model->npage, 8) / 8;
+	unsigned char *present = (unsigned char *)calloc(nbits, 1);
+	for (int i = 0; i < model->npage; i++) {
+		if (model->disk[i] != NULL) {
+			present[i >> 3] |= 1 << (i & 7);
+		}
+	}
+	err = err || write_block(f, present, nbits);
+	free(present);
+	err = err ||
+	      pad_to(f, memoff) ||
+	      write_block(f, model->mem, memsize) ||
+	      pad_to(f, ALIGNUP(memoff + memsize, VM_IMAGE_ALIGN));
+	// Pages never written back are left as holes in the file, which is
+	// extended to its full size without writing over the last page.
+	size_t diskoff = ALIGNUP(memoff + memsize, VM_IMAGE_ALIGN);
+	size_t bytes = PAGEBYTES(model);
+	for (int i = 0; i < model->npage && !err; i++) {
+		if (model->disk[i] != NULL) {
+			err = fseek(f, diskoff + i * bytes, SEEK_SET) ||
+			      write_block(f, model->disk[i]->data, bytes);
+		}
+	}
+	err = err || fflush(f) != 0 ||
+	      ftruncate(fileno(f), diskoff + (size_t)model->npage * bytes) != 0;
+	if (fclose(f) != 0 || err) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+// loadVM
+//
+// Create a virtual memory system from a file written by saveVM and
+// return a handle for it. The new system continues exactly where the
+// saved one stopped, so several experiments can start from the same
+// checkpoint.
+//
+// If the file cannot be read, or is not a checkpoint of this version,
+// an error message is printed to stderr and NULL is returned.
+//
+void *loadVM(const char *path) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		perror(path);
+		return NULL;
+	}
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(struct vm_image)) {
+		fprintf(stderr, "%s: not a VM checkpoint\n", path);
+		close(fd);
+		return NULL;
+	}
+	char *base = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		perror(path);
+		return NULL;
+	}
+	struct vm_image *h = (struct vm_image *)base;
+	if (memcmp(h->magic, VM_IMAGE_MAGIC, sizeof(h->magic)) != 0 ||
+	    h->version != VM_IMAGE_VERSION || h->size != sizeof(struct VM)) {
+		fprintf(stderr, "%s: not a version %d VM checkpoint\n", path, VM_IMAGE_VERSION);
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	struct VM *model = (struct VM*)malloc(sizeof(*model));
+	*model = h->model;
+	struct meta m[VM_MAX_BLOCKS];
+	int n = meta_blocks(model, m);
+	size_t memoff = ALIGNUP(image_meta_size(model), VM_IMAGE_ALIGN);
+	size_t memsize = model->ppage * PAGEBYTES(model);
+	size_t diskoff = ALIGNUP(memoff + memsize, VM_IMAGE_ALIGN);
+	size_t bytes = PAGEBYTES(model);
+	if ((size_t)st.st_size < diskoff + model->npage * bytes) {
+		fprintf(stderr, "%s: truncated VM checkpoint\n", path);
+		munmap(base, st.st_size);
+		free(model);
+		return NULL;
+	}
+	map_arena(model);
+	char *p = base + sizeof(*h);
+	for (int i = 0; i < n; i++) {
+		if (m[i].len) {
+			memcpy(*m[i].ptr, p, m[i].len);
+		}
+		p += m[i].len;
+	}
+	const unsigned char *present = (const unsigned char *)p;
+	memcpy(model->mem, base + memoff, memsize);
+	model->disk = DISK(model->pcap);
+	model->dused = NULL;
+	model->ndused = model->dcap = 0;
+	for (int i = 0; i < model->npage; i++) {
+		if (present[i >> 3] >> (i & 7) & 1) {
+			disk_write(model, i, base + diskoff + i * bytes);
+		}
+	}
+	munmap(base, st.st_size);
+	return model;
+}
+
+// cloneVM
+//
+// Create a copy of a virtual memory system and return a handle for it.
+// The copy has the same configuration, page table, TLB, replacement
+// state, statistics and memory contents as the original, and the two
+// evolve independently from then on.
+//
+// Physical memory and the metadata are copied. The disk image is shared
+// page by page and a page is only copied when one of the systems writes
+// it back, so cloning a large system is cheap.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+void *cloneVM(void *handle) {
+	struct VM *model = VM(handle);
+	struct VM *ret = (struct VM*)malloc(sizeof(*ret));
+	*ret = *model;
+	copy_arena(ret);
+	ret->disk = DISK(model->pcap);
+	ret->dused = model->dcap ? memcpy(malloc(model->dcap * sizeof(int)), model->dused,
+	                                  model->dcap * sizeof(int)) : NULL;
+	for (int i = 0; i < model->npage; i++) {
+		ret->disk[i] = model->disk[i];
+		if (ret->disk[i] != NULL) {
+			ret->disk[i]->ref++;
+		}
+	}
+	return ret;
+}
+
+// setHostPages
+//
+// Choose the kind of host pages backing the physical memory of the
+// simulated system: 0 for ordinary pages, 1 for transparent huge pages
+// (the default) or 2 for huge pages reserved by the administrator. Huge
+// pages make the TLB of the host cover a large simulated memory, which
+// speeds up simulations whose memory does not fit in it.
+//
+// Returns the kind of pages in use afterwards, which is lower than the
+// one asked for if the host cannot provide it.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int setHostPages(void *handle, int mode) {
+	struct VM *model = VM(handle);
+	struct VM old = *model;
+	model->hostpages = mode;
+	copy_arena(model);
+	struct meta m[VM_MAX_BLOCKS];
+	for (int i = meta_blocks(&old, m) - 1; i >= 0; i--) {
+		release(&old, *m[i].ptr);
+	}
+	munmap(old.arena, old.arenasize);
+	return model->hostpages;
+}
+
+// metadataBytes
+//
+// Return the number of bytes taken by the page table, the TLB and the
+// replacement and feature state of the virtual memory system, not
+// counting physical memory and the disk image. Systems with at most
+// 65534 pages and 8192 frames and TLB entries store page and frame
+// numbers and times in 16 bits, and so need about half as much.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+long metadataBytes(void *handle) {
+	struct meta m[VM_MAX_BLOCKS];
+	long bytes = 0;
+	for (int i = meta_blocks(VM(handle), m) - 1; i >= 0; i--) {
+		bytes += m[i].len;
+	}
+	return bytes;
+}
+
+// resetVM
+//
+// Return a virtual memory system to the initial state described at the
+// top of this file, as if it had just been created, and optionally
+// change its replacement algorithms. A pageReplAlg or tlbReplAlg of -1
+// keeps the current algorithm. Memory tiers, the working set window, the
+// TLB associativity, the admission filter, the reclaim watermarks, the
+// replacement scope, the fault time and load control stay configured,
+// with their statistics cleared. The readahead setting is kept, but page
+// advice and locks are forgotten, the vmMalloc heap is emptied, and the
+// address spaces made by forkAddressSpace and createAddressSpace, their
+// memory limits and the shared segments are discarded. A system made by
+// createDemandVM starts empty again.
+//
+// All allocations are reused, only the disk pages that were written back
+// are released, and only the frames that may hold data are cleared, so
+// resetting costs time in proportion to the state the previous run
+// touched rather than to the size of the system.
+//
+// Returns 0 on success, or -1 (leaving the system unchanged) if the new
+// TLB algorithm is tree-PLRU and the number of ways is not a power of two.
+//
+// If the handle is not one returned by createVM, the behavior is
+// undefined.
+//
+int resetVM(void *handle, int pageReplAlg, int tlbReplAlg) {
+	struct VM *model = VM(handle);
+	int palg = pageReplAlg < 0 ? model->palg : pageReplAlg;
+	int tlbalg = tlbReplAlg < 0 ? model->tlbalg : tlbReplAlg;
+	if (tlbalg == VM_TLB_TREE_PLRU_REPLACEMENT && (model->tlbways & (model->tlbways - 1)) != 0) {
+		return -1;
+	}
+	if (uses_nodes(model)) {
+		for (int i = 0; i < 2 * model->ppage + 2; i++) {
+			if (model->vnode[model->nodes[i].page] == i) {
+				model->vnode[model->nodes[i].page] = -1;
+			}
+		}
+	}
+	model->palg = palg;
+	model->tlbalg = tlbalg;
+	release(model, model->tlbbits);
+	model->tlbbits = uses_tlbbits(model) ? (uint64_t *)calloc(ALIGNUP(model->tlb, 64) / 64, 8) : NULL;
+	if (!uses_nodes(model)) {
+		release(model, model->nodes);
+		release(model, model->vnode);
+		model->nodes = NULL;
+		model->vnode = NULL;
+	}
+	for (int i = 0; i < model->ppage; i++) {
+		if (idx_get(model, model->pvirt, i) != i || dirty_get(model, i) || model->disk[i] != NULL) {
+			memset(make_address(model, i, 0), 0, PAGEBYTES(model));
+		}
+	}
+	for (int i = 0; i < model->ndused; i++) {
+		release_dpage(model->disk[model->dused[i]]);
+		model->disk[model->dused[i]] = NULL;
+	}
+	model->ndused = 0;
+	if (model->hsize > 0) {
+		memset(model->hkey, 0, model->hsize * sizeof(uint64_t));
+	}
+	model->hcount = 0;
+	model->npage = model->vpage;
+	model->tbase = 0;
+	for (int i = 0; i < model->ppage; i++) {
+		idx_set(model, model->pvirt, i, i);
+		time_set(model, model->ptime, i, 0);
+		dirty_set(model, i, 0);
+	}
+	for (int s = 0; s < model->tlbsets; s++) {
+		model->tlbset[s] = 0;
+		for (int w = 0; w < model->tlbways; w++) {
+			int i = s * model->tlbways + w;
+			idx_set(model, model->vtlb, i, w * model->tlbsets + s);
+			idx_set(model, model->ptlb, i, w * model->tlbsets + s);
+			time_set(model, model->tlbtime, i, 0);
+		}
+	}
+	model->rrp = model->rrt = model->timestamp = 0;
+	model->tlbrng = VM_TLB_SEED;
+	model->pc = model->tc = model->dc = 0;
+	model->wshand = 0;
+	model->wssum = model->wsmax = model->wsn = 0;
+	for (int i = 0; i < model->ntier; i++) {
+		model->tierhits[i] = model->tierprom[i] = model->tierdem[i] = 0;
+	}
+	if (model->ntier) {
+		memset(model->heat, 0, model->ppage * sizeof(int));
+	}
+	model->latency = 0;
+	if (model->sketch != NULL) {
+		memset(model->sketch, 0, VM_SKETCH_ROWS << model->sketchbits);
+	}
+	model->sketchn = model->rejpage = model->rejtlb = 0;
+	model->bypass = -1;
+	release(model, model->heapclass);
+	model->heapclass = NULL;
+	memset(model->heapn, 0, sizeof(model->heapn));
+	model->nruns = 0;
+	model->heaptop = 1;
+	model->heapobjs = model->heapwords = 0;
+	release(model, model->advice);
+	model->advice = NULL;
+	model->nfreeframes = 0;
+	model->coldfaults = model->released = 0;
+	model->direct = model->background = model->batches = model->wbruns = model->rfaults = 0;
+	model->rfree = 0;
+	model->prefetched = model->dropped = model->early = 0;
+	release(model, model->pinned);
+	release(model, model->pinnext);
+	model->pinned = NULL;
+	model->pinnext = NULL;
+	model->npinned = 0;
+	release(model, model->amap);
+	release(model, model->pshare);
+	release(model, model->rhead);
+	release(model, model->rnext);
+	release(model, model->rprev);
+	release(model, model->rss);
+	release(model, model->segbase);
+	release(model, model->seglen);
+	release(model, model->saccesses);
+	release(model, model->sfaults);
+	release(model, model->smisses);
+	model->saccesses = model->sfaults = model->smisses = NULL;
+	model->switches = 0;
+	model->elapsed = model->idle = 0;
+	model->suspensions = model->resumptions = model->swapped = 0;
+	release(model, model->fowner);
+	release(model, model->fnext);
+	release(model, model->fprev);
+	release(model, model->ohead);
+	release(model, model->otail);
+	release(model, model->ocount);
+	release(model, model->olimit);
+	model->fowner = model->fnext = model->fprev = NULL;
+	model->ohead = model->otail = model->ocount = model->olimit = NULL;
+	model->amap = model->pshare = NULL;
+	model->rhead = model->rnext = model->rprev = model->rss = NULL;
+	model->segbase = model->seglen = NULL;
+	model->nseg = 0;
+	model->nspace = 1;
+	model->curspace = 0;
+	model->cowshared = model->cowcopies = model->cowfaults = 0;
+	init_policy(model);
+	if (model->demand) {
+		empty_frames(model);
+	}
+	if (model->scope != VM_SCOPE_GLOBAL) {
+		init_owners(model);
+	}
+	return 0;
+}
+
+// createDemandVM
+//
+// Create a virtual memory system like createVM, except that physical
+// memory and the TLB start empty: there is no initial layout, every page
+// is loaded by its first access, and faults take free frames until there
+// are none left. printStatistics then reports how many faults filled a
+// free frame, which is the cost of warming up.
+//
+void *createDemandVM(unsigned int sizeVM, unsigned int sizePM, unsigned int pageSize,
+                     unsigned int sizeTLB, char pageReplAlg, char tlbReplAlg) {
+	void *handle = createVM(sizeVM, sizePM, pageSize, sizeTLB, pageReplAlg, tlbReplAlg);
+	if (handle != NULL) {
+		VM(handle)->demand = 1;
+		resetVM(handle, -1, -1);
+	}
+	return handle;
+}
+
+// cleanupVM
+//
+// Cleanup the memory used by the simulation of the virtual memory system.
 //
 // If the handle is not one returned by createVM, the behavior is
 // undefined.
 //
 void cleanupVM(void *handle) {
-	free(VM(handle)->pvirt);
-	free(VM(handle)->ptime);
-	free(VM(handle)->dirty);
-	free(VM(handle)->ptlb);
-	free(VM(handle)->vtlb);
-	free(VM(handle)->tlbtime);
-	free(VM(handle)->mem);
+	struct meta m[VM_MAX_BLOCKS];
+	for (int i = meta_blocks(VM(handle), m) - 1; i >= 0; i--) {
+		release(VM(handle), *m[i].ptr);
+	}
+	munmap(VM(handle)->arena, VM(handle)->arenasize);
+	for (int i = 0; i < VM(handle)->npage; i++) {
+		release_dpage(VM(handle)->disk[i]);
+	}
 	free(VM(handle)->disk);
+	free(VM(handle)->dused);
 	free(handle);
 }
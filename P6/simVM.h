@@ -0,0 +1,99 @@
+#ifndef SIMVM_H
+#define SIMVM_H
+
+//
+// A virtual memory simulation.
+//
+// Each function is described with its definition in simVM.c. A handle
+// is the value returned by createVM, createDemandVM, loadVM or cloneVM.
+//
+
+// Page replacement algorithms, for createVM and resetVM.
+#define VM_ROUNDROBIN_REPLACEMENT 0
+#define VM_LRU_REPLACEMENT 1
+#define VM_WSCLOCK_REPLACEMENT 2
+#define VM_2Q_REPLACEMENT 3
+#define VM_LIRS_REPLACEMENT 4
+
+// TLB replacement algorithms, for createVM and resetVM; 0 and 1 are
+// round-robin and LRU as for pages.
+#define VM_TLB_RANDOM_REPLACEMENT 2
+#define VM_TLB_TREE_PLRU_REPLACEMENT 3
+#define VM_TLB_BIT_PLRU_REPLACEMENT 4
+
+// Placement of faulted pages, for setMemoryTiers.
+#define VM_TIER_PLACE_VICTIM 0
+#define VM_TIER_PLACE_FAST 1
+
+// Host page modes, for setHostPages.
+#define VM_HOST_PAGES_NORMAL 0
+#define VM_HOST_PAGES_TRANSPARENT 1
+#define VM_HOST_PAGES_EXPLICIT 2
+
+// Hints, for adviseVM.
+#define VM_ADVISE_NORMAL 0
+#define VM_ADVISE_WILLNEED 1
+#define VM_ADVISE_DONTNEED 2
+#define VM_ADVISE_SEQUENTIAL 3
+#define VM_ADVISE_RANDOM 4
+
+// Replacement scopes, for setReplacementScope.
+#define VM_SCOPE_GLOBAL 0
+#define VM_SCOPE_LOCAL 1
+
+void *createVM(unsigned int sizeVM, unsigned int sizePM, unsigned int pageSize,
+               unsigned int sizeTLB, char pageReplAlg, char tlbReplAlg);
+void *createDemandVM(unsigned int sizeVM, unsigned int sizePM, unsigned int pageSize,
+                     unsigned int sizeTLB, char pageReplAlg, char tlbReplAlg);
+void cleanupVM(void *handle);
+int resetVM(void *handle, int pageReplAlg, int tlbReplAlg);
+void printStatistics(void *handle);
+
+int readInt(void *handle, unsigned int address);
+float readFloat(void *handle, unsigned int address);
+void writeInt(void *handle, unsigned int address, int value);
+void writeFloat(void *handle, unsigned int address, float value);
+int readInt64Addr(void *handle, unsigned long long address);
+float readFloat64Addr(void *handle, unsigned long long address);
+void writeInt64Addr(void *handle, unsigned long long address, int value);
+void writeFloat64Addr(void *handle, unsigned long long address, float value);
+
+int saveVM(void *handle, const char *path);
+void *loadVM(const char *path);
+void *cloneVM(void *handle);
+int setHostPages(void *handle, int mode);
+long metadataBytes(void *handle);
+
+int setMemoryTiers(void *handle, int ntier, const unsigned int *sizes,
+                   const unsigned int *latencies, int placement, unsigned int epoch);
+int setWorkingSetWindow(void *handle, unsigned int tau);
+int workingSetSize(void *handle);
+int setTLBAssociativity(void *handle, unsigned int ways);
+void setAdmissionFilter(void *handle, int pages, int tlb);
+int setReclaimWatermarks(void *handle, unsigned int low, unsigned int high);
+
+unsigned int vmMalloc(void *handle, unsigned int words);
+void vmFree(void *handle, unsigned int address);
+int adviseVM(void *handle, unsigned int start, unsigned int len, int hint);
+void setReadahead(void *handle, unsigned int pages);
+int lockPages(void *handle, unsigned int start, unsigned int len, int tlb);
+void unlockPages(void *handle, unsigned int start, unsigned int len);
+int releasePages(void *handle, unsigned int start, unsigned int len);
+
+int forkAddressSpace(void *handle);
+int createAddressSpace(void *handle);
+int switchAddressSpace(void *handle, int asid);
+int createSegment(void *handle, unsigned int pages);
+int attachSegment(void *handle, int seg, unsigned int start);
+int detachSegment(void *handle, int seg);
+int setReplacementScope(void *handle, int scope);
+int setMemoryLimit(void *handle, int asid, unsigned int frames);
+void setFaultTime(void *handle, unsigned int time);
+int setLoadControl(void *handle, unsigned int window, unsigned int low, unsigned int high);
+
+long replayTrace(void *handle, const char *path);
+long mixTraces(void *handle, const char **paths, int n, unsigned int quantum, int flush);
+long encodeTrace(const char *in, const char *out, unsigned int pageSize);
+long reduceTrace(const char *in, const char *out, unsigned int pageSize);
+
+#endif